@@ -99,12 +99,29 @@ bread(uint dev, uint blockno)
   struct buf *b;
 
   b = bget(dev, blockno);
-  if((b->flags & B_VALID) == 0) {
-    iderw(b);
+  if((b->flags & B_VALID) == 0 && iderw(b) < 0){
+    // Hand back zeroes, not whatever was in the buffer.
+    // B_VALID stays clear, so the next bread() retries.
+    cprintf("bread: i/o error on block %d\n", blockno);
+    memset(b->data, 0, BSIZE);
   }
   return b;
 }
 
+// Return a locked, zeroed buf for a block whose old
+// contents do not matter, such as a newly allocated one,
+// without reading it from disk.
+struct buf*
+bnew(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bget(dev, blockno);
+  memset(b->data, 0, BSIZE);
+  b->flags |= B_VALID;
+  return b;
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
@@ -112,7 +129,8 @@ bwrite(struct buf *b)
   if(!holdingsleep(&b->lock))
     panic("bwrite");
   b->flags |= B_DIRTY;
-  iderw(b);
+  if(iderw(b) < 0)
+    cprintf("bwrite: i/o error on block %d\n", b->blockno);
 }
 
 // Release a locked buffer.
@@ -7,8 +7,13 @@ struct buf {
   struct buf *prev; // LRU cache list
   struct buf *next;
   struct buf *qnext; // disk queue
+  struct buf *qprev;
+  int qidx;          // position in I/O scheduler heap
+  uint qtime;        // ticks when queued
+  uint qtsc;         // rdtsc() when queued
   uchar data[BSIZE];
 };
 #define B_VALID 0x2  // buffer has been read from disk
 #define B_DIRTY 0x4  // buffer needs to be written to disk
+#define B_ERROR 0x8  // the disk failed the last request
 
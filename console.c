@@ -10,6 +10,7 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "file.h"
+#include "fcntl.h"
 #include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
@@ -184,6 +185,7 @@ struct {
   uint r;  // Read index
   uint w;  // Write index
   uint e;  // Edit index
+  struct waitq rq;  // readers waiting for a line
 } input;
 
 #define C(x)  ((x)-'@')  // Control-x
@@ -191,7 +193,7 @@ struct {
 void
 consoleintr(int (*getc)(void))
 {
-  int c, doprocdump = 0;
+  int c, doprocdump = 0, dostatdump = 0;
 
   acquire(&cons.lock);
   while((c = getc()) >= 0){
@@ -200,6 +202,9 @@ consoleintr(int (*getc)(void))
       // procdump() locks cons.lock indirectly; invoke later
       doprocdump = 1;
       break;
+    case C('T'):  // Kernel statistics.
+      dostatdump = 1;
+      break;
     case C('U'):  // Kill line.
       while(input.e != input.w &&
             input.buf[(input.e-1) % INPUT_BUF] != '\n'){
@@ -220,7 +225,7 @@ consoleintr(int (*getc)(void))
         consputc(c);
         if(c == '\n' || c == C('D') || input.e == input.r+INPUT_BUF){
           input.w = input.e;
-          wakeup(&input.r);
+          waitqwakeup(&input.rq);
         }
       }
       break;
@@ -230,6 +235,11 @@ consoleintr(int (*getc)(void))
   if(doprocdump) {
     procdump();  // now call procdump() wo. cons.lock held
   }
+  if(dostatdump){
+    iostatdump();
+    istatdump();
+    dstatdump();
+  }
 }
 
 int
@@ -248,7 +258,7 @@ consoleread(struct inode *ip, char *dst, int n)
         ilock(ip);
         return -1;
       }
-      sleep(&input.r, &cons.lock);
+      waitqsleep(&input.rq, &cons.lock);
     }
     c = input.buf[input.r++ % INPUT_BUF];
     if(c == C('D')){  // EOF
@@ -270,6 +280,21 @@ consoleread(struct inode *ip, char *dst, int n)
   return target - n;
 }
 
+// Input is ready once a whole line is; output always is.
+int
+consolepoll(struct inode *ip, struct waiter *w)
+{
+  int ev;
+
+  acquire(&cons.lock);
+  waitqadd(&input.rq, w);
+  ev = POLLOUT;
+  if(input.r != input.w)
+    ev |= POLLIN;
+  release(&cons.lock);
+  return ev;
+}
+
 int
 consolewrite(struct inode *ip, char *buf, int n)
 {
@@ -292,6 +317,7 @@ consoleinit(void)
 
   devsw[CONSOLE].write = consolewrite;
   devsw[CONSOLE].read = consoleread;
+  devsw[CONSOLE].poll = consolepoll;
   cons.locking = 1;
 
   ioapicenable(IRQ_KBD, 0);
@@ -0,0 +1,212 @@
+// Directory entry cache.
+//
+// Remembers the result of dirlookup(): which inode, and at
+// what offset, a name in a directory refers to.  A negative
+// entry (inum 0) records that the directory has no such name,
+// so that repeated failing lookups, such as a shell searching
+// for a command, do not scan the directory either.
+//
+// Entries are keyed by (dev, directory inum, name) and live on
+// a hash table, with all of them on an LRU list from which
+// dcacheenter() recycles the least recently used.
+//
+// The cache is only correct if every change to a directory's
+// entries goes through it: dirlink() enters the new name, or
+// purges the directory's entries if it had to move them to
+// other blocks, sys_unlink() turns the removed name into a
+// negative entry, and iput() purges a directory's entries
+// when it frees the directory's inode.  All of these, like dirlookup(), run with
+// the directory locked, so a directory's entries do not change
+// between looking at the disk and updating the cache.  dcache.lock
+// protects the table itself.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+
+#define NDHASH 256
+
+struct dentry {
+  uint dev;
+  uint dir;               // inum of the directory; 0 if unused
+  uint inum;              // 0 for a negative entry
+  uint off;               // offset of the dirent in dir
+  char name[DIRSIZ];
+  struct dentry *hnext;   // hash chain
+  struct dentry *prev;    // LRU list
+  struct dentry *next;
+};
+
+static struct {
+  struct spinlock lock;
+  struct dentry *hash[NDHASH];
+  struct dentry lru;      // oldest first
+  int n;
+  uint hits;
+  uint neghits;           // hits on negative entries
+  uint misses;
+} dcache;
+
+static uint
+dhash(uint dev, uint dir, char *name)
+{
+  uint h;
+  int i;
+
+  h = dev * 31 + dir;
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = h * 31 + (uchar)name[i];
+  return h % NDHASH;
+}
+
+static void
+lruremove(struct dentry *d)
+{
+  d->prev->next = d->next;
+  d->next->prev = d->prev;
+}
+
+// Most recently used goes last.
+static void
+lruappend(struct dentry *d)
+{
+  d->prev = dcache.lru.prev;
+  d->next = &dcache.lru;
+  d->prev->next = d;
+  dcache.lru.prev = d;
+}
+
+static void
+unhash(struct dentry *d)
+{
+  struct dentry **pp;
+
+  for(pp = &dcache.hash[dhash(d->dev, d->dir, d->name)]; *pp != d; pp = &(*pp)->hnext)
+    ;
+  *pp = d->hnext;
+  d->dir = 0;
+}
+
+// Caller must hold dcache.lock.
+static struct dentry*
+dfind(uint dev, uint dir, char *name)
+{
+  struct dentry *d;
+
+  for(d = dcache.hash[dhash(dev, dir, name)]; d; d = d->hnext)
+    if(d->dev == dev && d->dir == dir && namecmp(d->name, name) == 0)
+      return d;
+  return 0;
+}
+
+void
+dcacheinit(void)
+{
+  struct dentry *d;
+  char *p;
+  int i, n;
+
+  initlock(&dcache.lock, "dcache");
+  dcache.lru.prev = dcache.lru.next = &dcache.lru;
+  for(n = (NDENTRY * sizeof(*d) + PGSIZE - 1) / PGSIZE; n > 0; n--){
+    if((p = kalloc()) == 0)
+      panic("dcacheinit: out of memory");
+    memset(p, 0, PGSIZE);
+    for(i = 0; i < PGSIZE / sizeof(*d); i++){
+      d = (struct dentry*)p + i;
+      lruappend(d);
+      dcache.n++;
+    }
+  }
+}
+
+// Look up name in directory dp.  If the cache knows the
+// answer, set *inum (0 if there is no such name) and *off,
+// and return 1.  Otherwise return 0.
+int
+dcachelookup(struct inode *dp, char *name, uint *inum, uint *off)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  if((d = dfind(dp->dev, dp->inum, name)) == 0){
+    dcache.misses++;
+    release(&dcache.lock);
+    return 0;
+  }
+  *inum = d->inum;
+  *off = d->off;
+  if(d->inum)
+    dcache.hits++;
+  else
+    dcache.neghits++;
+  lruremove(d);
+  lruappend(d);
+  release(&dcache.lock);
+  return 1;
+}
+
+// Record that name in directory dp refers to inum, whose
+// dirent is at off, or, if inum is 0, that there is no name.
+// Caller must hold dp->lock.
+void
+dcacheenter(struct inode *dp, char *name, uint inum, uint off)
+{
+  struct dentry *d;
+  uint h;
+
+  acquire(&dcache.lock);
+  if((d = dfind(dp->dev, dp->inum, name)) == 0){
+    d = dcache.lru.next;
+    if(d->dir != 0)
+      unhash(d);
+    d->dev = dp->dev;
+    d->dir = dp->inum;
+    strncpy(d->name, name, DIRSIZ);
+    h = dhash(d->dev, d->dir, d->name);
+    d->hnext = dcache.hash[h];
+    dcache.hash[h] = d;
+  }
+  d->inum = inum;
+  d->off = off;
+  lruremove(d);
+  lruappend(d);
+  release(&dcache.lock);
+}
+
+// Forget every entry of directory dir: its inode is being
+// freed and the inum may be reused, or its entries moved.
+void
+dcachepurge(uint dev, uint dir)
+{
+  struct dentry *d, *next;
+
+  acquire(&dcache.lock);
+  for(d = dcache.lru.next; d != &dcache.lru; d = next){
+    next = d->next;
+    if(d->dir != dir || d->dev != dev)
+      continue;
+    unhash(d);
+    // Unused entries are recycled first.
+    lruremove(d);
+    d->next = dcache.lru.next;
+    d->prev = &dcache.lru;
+    d->next->prev = d;
+    dcache.lru.next = d;
+  }
+  release(&dcache.lock);
+}
+
+// Print directory entry cache statistics to the console.
+void
+dstatdump(void)
+{
+  cprintf("dcache: %d entries, %d hits, %d negative hits, %d misses\n",
+          dcache.n, dcache.hits, dcache.neghits, dcache.misses);
+}
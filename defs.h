@@ -2,6 +2,7 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct pcidev;
 struct pipe;
 struct proc;
 struct rtcdate;
@@ -9,9 +10,13 @@ struct spinlock;
 struct sleeplock;
 struct stat;
 struct superblock;
+struct vdso;
+struct waiter;
+struct waitq;
 
 // bio.c
 void            binit(void);
+struct buf*     bnew(uint, uint);
 struct buf*     bread(uint, uint);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
@@ -22,6 +27,13 @@ void            cprintf(char*, ...);
 void            consoleintr(int(*)(void));
 void            panic(char*) __attribute__((noreturn));
 
+// dcache.c
+void            dcacheenter(struct inode*, char*, uint, uint);
+void            dcacheinit(void);
+int             dcachelookup(struct inode*, char*, uint*, uint*);
+void            dcachepurge(uint, uint);
+void            dstatdump(void);
+
 // exec.c
 int             exec(char*, char**);
 
@@ -29,10 +41,17 @@ int             exec(char*, char**);
 struct file*    filealloc(void);
 void            fileclose(struct file*);
 struct file*    filedup(struct file*);
+int             filefallocate(struct file*, int);
 void            fileinit(void);
+int             filepoll(struct file*, struct waiter*);
+int             filepread(struct file*, char*, int n, int off);
+int             filepwrite(struct file*, char*, int n, int off);
 int             fileread(struct file*, char*, int n);
 int             filestat(struct file*, struct stat*);
 int             filewrite(struct file*, char*, int n);
+int             filesendfile(struct file*, struct file*, int);
+int             filesplice(struct file*, struct file*, int);
+int             filetee(struct file*, struct file*, int);
 
 // fs.c
 void            readsb(int dev, struct superblock *sb);
@@ -42,26 +61,40 @@ struct inode*   ialloc(uint, short);
 struct inode*   idup(struct inode*);
 void            iinit(int dev);
 void            ilock(struct inode*);
+int             ismountpoint(struct inode*);
 void            iput(struct inode*);
+int             ireserve(struct inode*, uint);
 void            iunlock(struct inode*);
 void            iunlockput(struct inode*);
+void            istatdump(void);
 void            iupdate(struct inode*);
+int             mount(struct inode*, struct inode*);
 int             namecmp(const char*, const char*);
 struct inode*   namei(char*);
 struct inode*   nameiparent(char*, char*);
 int             readi(struct inode*, char*, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, char*, uint, uint);
+int             writeibulk(struct inode*, char*, uint, uint);
 
 // ide.c
 void            ideinit(void);
 void            ideintr(void);
-void            iderw(struct buf*);
+int             iderw(struct buf*);
+
+// iosched.c
+void            ioschedadd(struct buf*);
+void            ioscheddone(struct buf*);
+void            ioschedinit(void);
+struct buf*     ioschednext(void);
+void            iostatdump(void);
 
 // ioapic.c
 void            ioapicenable(int irq, int cpu);
 extern uchar    ioapicid;
 void            ioapicinit(void);
+void            ioapicroute(int irq, int vec, int cpu);
+void            ioapicroutepci(int irq, int vec, int cpu);
 
 // kalloc.c
 char*           kalloc(void);
@@ -84,13 +117,23 @@ void            microdelay(int);
 // log.c
 void            initlog(int dev);
 void            log_write(struct buf*);
-void            begin_op();
+void            begin_op(int);
 void            end_op();
+void            log_freed(void);
+void            log_sync(void);
+int             log_ordered(struct buf*);
+int             log_room(void);
 
 // mp.c
 extern int      ismp;
 void            mpinit(void);
 
+// pci.c
+void            pcienable(struct pcidev*);
+int             pcifind(uint, uint, int, int, struct pcidev*);
+uint            pciconfread(struct pcidev*, int);
+void            pciconfwrite(struct pcidev*, int, uint);
+
 // picirq.c
 void            picenable(int);
 void            picinit(void);
@@ -98,8 +141,13 @@ void            picinit(void);
 // pipe.c
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
-int             piperead(struct pipe*, char*, int);
-int             pipewrite(struct pipe*, char*, int);
+int             pipepoll(struct pipe*, int, struct waiter*);
+int             piperead(struct pipe*, char*, int, int);
+int             pipewrite(struct pipe*, char*, int, int);
+int             pipesize(struct pipe*, int);
+int             pipesplicein(struct pipe*, struct file*, int);
+int             pipespliceout(struct pipe*, struct file*, int);
+int             pipetee(struct pipe*, struct pipe*, int);
 
 //PAGEBREAK: 16
 // proc.c
@@ -108,6 +156,7 @@ void            exit(void);
 int             fork(void);
 int             growproc(int);
 int             kill(int);
+void            kproc(char*, void(*)(void));
 struct cpu*     mycpu(void);
 struct proc*    myproc();
 void            pinit(void);
@@ -119,6 +168,11 @@ void            sleep(void*, struct spinlock*);
 void            userinit(void);
 int             wait(void);
 void            wakeup(void*);
+void            waitqadd(struct waitq*, struct waiter*);
+void            waitqblock(int*, int);
+void            waitqremove(struct waiter*);
+void            waitqsleep(struct waitq*, struct spinlock*);
+void            waitqwakeup(struct waitq*);
 void            yield(void);
 
 // MODIFIED CODE ---------------------------------------------------------->
@@ -166,11 +220,26 @@ int             fetchint(uint, int*);
 int             fetchstr(uint, char**);
 void            syscall(void);
 
+// sysfile.c
+int             ringdrain(int, int);
+
 // timer.c
 void            timerinit(void);
 
+// tmpfs.c
+uint            tmpialloc(short);
+void            tmpiload(struct inode*);
+void            tmpinit(void);
+void            tmpiupdate(struct inode*);
+struct inode*   tmpmount(void);
+int             tmpread(struct inode*, char*, uint, uint);
+void            tmptrunc(struct inode*);
+int             tmpwrite(struct inode*, char*, uint, uint);
+
 // trap.c
 void            idtinit(void);
+extern int      nosysenter;
+void            sysenterinit(void);
 extern uint     ticks;
 void            tvinit(void);
 extern struct spinlock tickslock;
@@ -180,6 +249,12 @@ void            uartinit(void);
 void            uartintr(void);
 void            uartputc(int);
 
+// vdso.c
+extern struct vdso *vdso;
+void            vdsoinit(void);
+void            vdsoswitch(struct proc*, int);
+void            vdsotick(void);
+
 // vm.c
 void            seginit(void);
 void            kvmalloc(void);
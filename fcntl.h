@@ -2,3 +2,29 @@
 #define O_WRONLY  0x001
 #define O_RDWR    0x002
 #define O_CREATE  0x200
+#define O_NONBLOCK 0x800
+
+// fcntl() commands
+#define F_GETFL   3
+#define F_SETFL   4
+
+// poll() events
+#define POLLIN    0x01  // there is data to read
+#define POLLOUT   0x04  // writing would not block
+#define POLLERR   0x08  // write end of a pipe with no readers
+#define POLLHUP   0x10  // read end of a pipe with no writers
+#define POLLNVAL  0x20  // fd is not open
+
+struct pollfd {
+  int fd;
+  short events;   // requested
+  short revents;  // returned
+};
+
+// readv() and writev() buffers
+#define IOV_MAX   16  // most buffers in one call
+
+struct iovec {
+  void *base;
+  int len;
+};
@@ -5,10 +5,13 @@
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "stat.h"
+#include "mmu.h"
 #include "fs.h"
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "fcntl.h"
 
 struct devsw devsw[NDEV];
 struct {
@@ -32,6 +35,7 @@ filealloc(void)
   for(f = ftable.file; f < ftable.file + NFILE; f++){
     if(f->ref == 0){
       f->ref = 1;
+      f->nonblock = 0;
       release(&ftable.lock);
       return f;
     }
@@ -73,7 +77,7 @@ fileclose(struct file *f)
   if(ff.type == FD_PIPE)
     pipeclose(ff.pipe, ff.writable);
   else if(ff.type == FD_INODE){
-    begin_op();
+    begin_op(OP_IPUT);
     iput(ff.ip);
     end_op();
   }
@@ -92,66 +96,221 @@ filestat(struct file *f, struct stat *st)
   return -1;
 }
 
-// Read from file f.
+// Report which poll() events hold for f, and add w to
+// the wait queue that will announce changes.
 int
-fileread(struct file *f, char *addr, int n)
+filepoll(struct file *f, struct waiter *w)
 {
-  int r;
+  struct inode *ip;
 
-  if(f->readable == 0)
-    return -1;
   if(f->type == FD_PIPE)
-    return piperead(f->pipe, addr, n);
+    return pipepoll(f->pipe, f->writable, w);
   if(f->type == FD_INODE){
+    // An open inode's type and major do not change,
+    // so there is no need to lock it.
+    ip = f->ip;
+    if(ip->type == T_DEV && ip->major >= 0 && ip->major < NDEV && devsw[ip->major].poll)
+      return devsw[ip->major].poll(ip, w);
+    return POLLIN | POLLOUT;
+  }
+  return POLLNVAL;
+}
+
+// Read n bytes of f's inode at *off, and advance *off.
+static int
+inoderead(struct file *f, char *addr, int n, uint *off)
+{
+  int r;
+
+  ilock(f->ip);
+  if((r = readi(f->ip, addr, *off, n)) > 0)
+    *off += r;
+  iunlock(f->ip);
+  return r;
+}
+
+// Write n bytes to f's inode at *off, and advance *off.
+static int
+inodewrite(struct file *f, char *addr, int n, uint *off)
+{
+  int r;
+
+  // write a few blocks at a time to avoid exceeding
+  // the maximum log transaction size, including
+  // i-node, indirect block, allocation blocks,
+  // and 2 blocks of slop for non-aligned writes.
+  // this really belongs lower down, since writei()
+  // might be writing a device like the console.
+  // Longer writes go through writeibulk(), which keeps
+  // new blocks out of the log and writes as much in one
+  // transaction as the log has room for.
+  int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+  int i = 0;
+
+  // tmpfs writes nothing to the log.
+  if(f->ip->dev == TMPDEV){
     ilock(f->ip);
-    if((r = readi(f->ip, addr, f->off, n)) > 0)
-      f->off += r;
+    if((r = writei(f->ip, addr, *off, n)) > 0)
+      *off += r;
     iunlock(f->ip);
     return r;
   }
+
+  while(i < n){
+    int n1 = n - i;
+
+    begin_op(OP_WRITE);
+    ilock(f->ip);
+    if(n1 > max){
+      if(n1 > BULKBLOCKS*BSIZE)
+        n1 = BULKBLOCKS*BSIZE;
+      r = writeibulk(f->ip, addr + i, *off, n1);
+    } else
+      r = writei(f->ip, addr + i, *off, n1);
+    if(r > 0)
+      *off += r;
+    iunlock(f->ip);
+    end_op();
+
+    if(r < 0)
+      break;
+    i += r;
+    if(r != n1 && n1 <= max)
+      break;  // the file has run out of extents
+  }
+  return i > 0 ? i : -1;
+}
+
+// Read from file f.
+int
+fileread(struct file *f, char *addr, int n)
+{
+  if(f->readable == 0)
+    return -1;
+  if(f->type == FD_PIPE)
+    return piperead(f->pipe, addr, n, f->nonblock);
+  if(f->type == FD_INODE){
+    if(f->nonblock && (filepoll(f, 0) & POLLIN) == 0)
+      return -1;
+    return inoderead(f, addr, n, &f->off);
+  }
   panic("fileread");
 }
 
+// Read from file f at offset off, leaving f->off alone.
+int
+filepread(struct file *f, char *addr, int n, int off)
+{
+  uint o;
+
+  if(f->readable == 0 || f->type != FD_INODE || off < 0)
+    return -1;
+  o = off;
+  return inoderead(f, addr, n, &o);
+}
+
 //PAGEBREAK!
 // Write to file f.
 int
 filewrite(struct file *f, char *addr, int n)
 {
-  int r;
-
   if(f->writable == 0)
     return -1;
   if(f->type == FD_PIPE)
-    return pipewrite(f->pipe, addr, n);
-  if(f->type == FD_INODE){
-    // write a few blocks at a time to avoid exceeding
-    // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
-    // this really belongs lower down, since writei()
-    // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * 512;
-    int i = 0;
-    while(i < n){
-      int n1 = n - i;
-      if(n1 > max)
-        n1 = max;
-
-      begin_op();
-      ilock(f->ip);
-      if ((r = writei(f->ip, addr + i, f->off, n1)) > 0)
-        f->off += r;
-      iunlock(f->ip);
-      end_op();
-
-      if(r < 0)
-        break;
-      if(r != n1)
-        panic("short filewrite");
-      i += r;
-    }
-    return i == n ? n : -1;
-  }
+    return pipewrite(f->pipe, addr, n, f->nonblock);
+  if(f->type == FD_INODE)
+    return inodewrite(f, addr, n, &f->off);
   panic("filewrite");
 }
 
+// Write to file f at offset off, leaving f->off alone.
+int
+filepwrite(struct file *f, char *addr, int n, int off)
+{
+  uint o;
+
+  if(f->writable == 0 || f->type != FD_INODE || off < 0)
+    return -1;
+  o = off;
+  return inodewrite(f, addr, n, &o);
+}
+
+// Reserve disk space for file f to grow to n bytes.
+int
+filefallocate(struct file *f, int n)
+{
+  int r;
+
+  if(f->writable == 0 || f->type != FD_INODE || n < 0)
+    return -1;
+  // a few runs of blocks at a time, as in filewrite().
+  do {
+    begin_op(OP_WRITE);
+    ilock(f->ip);
+    r = ireserve(f->ip, ((uint)n + BSIZE - 1) / BSIZE);
+    iunlock(f->ip);
+    end_op();
+  } while(r > 0);
+  return r;
+}
+
+
+//PAGEBREAK!
+// Move up to n bytes between in and out, one of which is
+// a pipe, without copying through user space.
+int
+filesplice(struct file *in, struct file *out, int n)
+{
+  if(in->readable == 0 || out->writable == 0 || n < 0)
+    return -1;
+  if(in->type == FD_INODE && out->type == FD_PIPE)
+    return pipesplicein(out->pipe, in, n);
+  if(in->type == FD_PIPE && out->type != FD_NONE){
+    if(out->type == FD_PIPE && out->pipe == in->pipe)
+      return -1;
+    return pipespliceout(in->pipe, out, n);
+  }
+  return -1;
+}
+
+// Copy up to n bytes from pipe in to pipe out,
+// leaving them in in.
+int
+filetee(struct file *in, struct file *out, int n)
+{
+  if(in->readable == 0 || out->writable == 0 || n < 0)
+    return -1;
+  if(in->type != FD_PIPE || out->type != FD_PIPE || in->pipe == out->pipe)
+    return -1;
+  return pipetee(in->pipe, out->pipe, n);
+}
+
+// Copy up to n bytes from file in to out.  Into a pipe,
+// this is a splice; otherwise the data goes through a
+// kernel page rather than user space.
+int
+filesendfile(struct file *out, struct file *in, int n)
+{
+  char *buf;
+  int i, r, w;
+
+  if(in->readable == 0 || out->writable == 0 || in->type != FD_INODE || n < 0)
+    return -1;
+  if(out->type == FD_PIPE)
+    return pipesplicein(out->pipe, in, n);
+  if((buf = kalloc()) == 0)
+    return -1;
+  r = 0;
+  for(i = 0; i < n; i += r){
+    if((r = fileread(in, buf, n - i < PGSIZE ? n - i : PGSIZE)) <= 0)
+      break;
+    if((w = filewrite(out, buf, r)) != r){
+      if(w > 0)
+        i += w;
+      r = w < 0 ? w : 0;
+      break;
+    }
+  }
+  kfree(buf);
+  return i > 0 ? i : r;
+}
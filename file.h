@@ -3,6 +3,7 @@ struct file {
   int ref; // reference count
   char readable;
   char writable;
+  char nonblock; // O_NONBLOCK
   struct pipe *pipe;
   struct inode *ip;
   uint off;
@@ -14,6 +15,9 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  struct inode *hnext; // icache hash chain
+  struct inode *prev; // icache LRU list, while ref is 0
+  struct inode *next;
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
@@ -22,7 +26,11 @@ struct inode {
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  ushort flags;
+  uint addrs[NDIRECT+3];
+  uint indaddr;       // last indirect block bmap() used, or 0
+  uint indbase;       // first file block (after NDIRECT) it maps
+  uint prealloc;      // blocks emap() mapped ahead of need, for iput()
 };
 
 // table mapping major device number to
@@ -30,6 +38,7 @@ struct inode {
 struct devsw {
   int (*read)(struct inode*, char*, int);
   int (*write)(struct inode*, char*, int);
+  int (*poll)(struct inode*, struct waiter*);  // 0 if always ready
 };
 
 extern struct devsw devsw[];
@@ -13,6 +13,7 @@
 #include "defs.h"
 #include "param.h"
 #include "stat.h"
+#include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
 #include "spinlock.h"
@@ -23,6 +24,8 @@
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 static void itrunc(struct inode*);
+static void iuninline(struct inode*);
+static void etrim(struct inode*);
 // there should be one superblock per disk device, but we run with
 // only one device
 struct superblock sb; 
@@ -44,54 +47,205 @@ bzero(int dev, int bno)
 {
   struct buf *bp;
 
-  bp = bread(dev, bno);
-  memset(bp->data, 0, BSIZE);
+  bp = bnew(dev, bno);
   log_write(bp);
   brelse(bp);
 }
 
 // Blocks.
+//
+// Blocks are allocated in allocation groups: group g is the
+// BPB blocks whose bits are in bitmap block g.  iinit() builds
+// an in-memory summary of each group, so that balloc() can skip
+// full groups without reading their bitmap blocks, start its
+// search within a group past the blocks known to be in use,
+// and rotate through a group instead of refilling its start.
+//
+// balloc() takes a goal block to allocate near.  bmap() passes
+// the block after the file's previous one, so that files stay
+// contiguous, and for a file's first block igoal(), which puts
+// the data of consecutively numbered inodes in the same group.
+
+struct {
+  struct spinlock lock;
+  int ngroup;
+  uint nfree[NGROUP];  // free blocks in the group
+  uint first[NGROUP];  // every block before this one is in use
+  uint next[NGROUP];   // just after the group's last allocation
+} bgroup;
+
+// Build the allocation group summary from the bitmap.
+static void
+bgroupinit(int dev)
+{
+  struct buf *bp;
+  int g, bi;
+
+  initlock(&bgroup.lock, "bgroup");
+  bgroup.ngroup = (sb.size + BPB - 1) / BPB;
+  if(bgroup.ngroup > NGROUP)
+    panic("bgroupinit: too many bitmap blocks");
+  for(g = 0; g < bgroup.ngroup; g++){
+    bp = bread(dev, BBLOCK(g*BPB, sb));
+    bgroup.first[g] = BPB;
+    for(bi = 0; bi < BPB && g*BPB + bi < sb.size; bi++){
+      if((bp->data[bi/8] & (1 << (bi%8))) == 0){
+        bgroup.nfree[g]++;
+        if(bgroup.first[g] == BPB)
+          bgroup.first[g] = bi;
+      }
+    }
+    brelse(bp);
+  }
+}
 
-// Allocate a zeroed disk block.
+// Return the first free bit from..to-1 in bitmap block bp, or -1.
+static int
+bfind(struct buf *bp, int from, int to)
+{
+  int bi;
+
+  for(bi = from; bi < to; bi++){
+    if(bp->data[bi/8] == 0xFF)
+      bi |= 7;  // whole byte in use
+    else if((bp->data[bi/8] & (1 << (bi%8))) == 0)
+      return bi;
+  }
+  return -1;
+}
+
+// Allocate a disk block, without clearing it: the first free
+// one at or after goal in goal's group, or failing that the
+// first free one in the group, or in the groups after it.
 static uint
-balloc(uint dev)
+bclaim(uint dev, uint goal)
 {
-  int b, bi, m;
+  int g, i, bi, first, n, lim;
   struct buf *bp;
 
-  bp = 0;
-  for(b = 0; b < sb.size; b += BPB){
+  if(goal >= sb.size)
+    goal = 0;
+  for(i = 0; i < bgroup.ngroup; i++){
+    g = (goal/BPB + i) % bgroup.ngroup;
+    acquire(&bgroup.lock);
+    n = bgroup.nfree[g];
+    first = bgroup.first[g];
+    release(&bgroup.lock);
+    if(n == 0)
+      continue;
+
+    bp = bread(dev, BBLOCK(g*BPB, sb));
+    lim = min(BPB, sb.size - g*BPB);
+    bi = -1;
+    if(i == 0 && goal % BPB > first)
+      bi = bfind(bp, goal % BPB, lim);
+    if(bi < 0)
+      bi = bfind(bp, first, lim);
+    if(bi >= 0){
+      bp->data[bi/8] |= 1 << (bi%8);  // Mark block in use.
+      log_write(bp);
+      acquire(&bgroup.lock);
+      bgroup.nfree[g]--;
+      if(bgroup.first[g] == bi)
+        bgroup.first[g] = bi + 1;
+      bgroup.next[g] = bi + 1;
+      release(&bgroup.lock);
+      brelse(bp);
+      return g*BPB + bi;
+    }
+    brelse(bp);
+  }
+  panic("balloc: out of blocks");
+}
+
+// Allocate a zeroed disk block near goal.
+static uint
+balloc(uint dev, uint goal)
+{
+  uint b;
+
+  b = bclaim(dev, goal);
+  bzero(dev, b);
+  return b;
+}
+
+// Extend a run of blocks that ends just before b: allocate up
+// to n free blocks starting at b, stopping at the first block
+// in use or at the end of b's group.  Does not clear them.
+// Returns how many it allocated.
+static uint
+bextend(uint dev, uint b, uint n)
+{
+  struct buf *bp;
+  uint g, bi, lim, i;
+
+  if(n == 0 || b >= sb.size)
+    return 0;
+  g = b / BPB;
+  lim = min(BPB, sb.size - g*BPB);
+  bp = bread(dev, BBLOCK(b, sb));
+  for(i = 0, bi = b % BPB; i < n && bi < lim; i++, bi++){
+    if(bp->data[bi/8] & (1 << (bi%8)))
+      break;
+    bp->data[bi/8] |= 1 << (bi%8);
+  }
+  if(i > 0){
+    log_write(bp);
+    acquire(&bgroup.lock);
+    bgroup.nfree[g] -= i;
+    if(bgroup.first[g] >= b % BPB && bgroup.first[g] < bi)
+      bgroup.first[g] = bi;
+    bgroup.next[g] = bi;
+    release(&bgroup.lock);
+  }
+  brelse(bp);
+  return i;
+}
+
+// Free n disk blocks starting at b, reading
+// each bitmap block involved only once.
+static void
+bfreerun(int dev, uint b, uint n)
+{
+  struct buf *bp;
+  int g, bi, m;
+
+  while(n > 0){
+    g = b / BPB;
     bp = bread(dev, BBLOCK(b, sb));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
+    acquire(&bgroup.lock);
+    for(bi = b % BPB; bi < BPB && n > 0; bi++, b++, n--){
       m = 1 << (bi % 8);
-      if((bp->data[bi/8] & m) == 0){  // Is block free?
-        bp->data[bi/8] |= m;  // Mark block in use.
-        log_write(bp);
-        brelse(bp);
-        bzero(dev, b + bi);
-        return b + bi;
-      }
+      if((bp->data[bi/8] & m) == 0)
+        panic("freeing free block");
+      bp->data[bi/8] &= ~m;
+      bgroup.nfree[g]++;
+      if(bi < bgroup.first[g])
+        bgroup.first[g] = bi;
     }
+    release(&bgroup.lock);
+    log_write(bp);
     brelse(bp);
   }
-  panic("balloc: out of blocks");
+  log_freed();
 }
 
 // Free a disk block.
 static void
 bfree(int dev, uint b)
 {
-  struct buf *bp;
-  int bi, m;
+  bfreerun(dev, b, 1);
+}
 
-  bp = bread(dev, BBLOCK(b, sb));
-  bi = b % BPB;
-  m = 1 << (bi % 8);
-  if((bp->data[bi/8] & m) == 0)
-    panic("freeing free block");
-  bp->data[bi/8] &= ~m;
-  log_write(bp);
-  brelse(bp);
+// Where to put the first block of ip: after the last
+// allocation in the group that ip's inode number maps to.
+static uint
+igoal(struct inode *ip)
+{
+  uint g;
+
+  g = ip->inum * bgroup.ngroup / sb.ninodes;
+  return g*BPB + bgroup.next[g];
 }
 
 // Inodes.
@@ -162,20 +316,65 @@ bfree(int dev, uint b)
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
+//
+// iget() finds cached inodes through a hash table on (dev, inum).
+// Entries with ref zero stay cached, and valid, on an LRU list,
+// and iget() recycles the least recently used of them.  The
+// cache takes 1/ICACHEFRAC of memory, but has at least NINODE
+// entries.
+
+#define NIHASH 512
+#define IHASH(dev, inum) (((dev) * 31 + (inum)) % NIHASH)
 
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct inode *hash[NIHASH]; // chains through ip->hnext
+  struct inode lru;           // ref == 0, oldest first; through prev/next
+  int ninode;
+  uint hits;                  // iget() found the inode cached
+  uint misses;
 } icache;
 
+// The mount table.  Each entry makes the root directory of
+// another file system appear in place of directory on.  Both
+// inodes stay referenced while mounted, so the same in-memory
+// inodes stand for them and namex() can compare addresses.
+struct {
+  struct spinlock lock;
+  struct {
+    struct inode *on;
+    struct inode *root;
+  } m[NMOUNT];
+} mtab;
+
 void
 iinit(int dev)
 {
-  int i = 0;
-  
+  struct inode *ip;
+  char *p;
+  int i, n;
+
   initlock(&icache.lock, "icache");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&icache.inode[i].lock, "inode");
+  initlock(&mtab.lock, "mtab");
+  dcacheinit();
+  tmpinit();
+  icache.lru.prev = icache.lru.next = &icache.lru;
+  n = PHYSTOP / ICACHEFRAC / PGSIZE;
+  if(n < (NINODE * sizeof(*ip) + PGSIZE - 1) / PGSIZE)
+    n = (NINODE * sizeof(*ip) + PGSIZE - 1) / PGSIZE;
+  while(n-- > 0){
+    if((p = kalloc()) == 0)
+      panic("iinit: out of memory");
+    for(i = 0; i < PGSIZE / sizeof(*ip); i++){
+      ip = (struct inode*)p + i;
+      memset(ip, 0, sizeof(*ip));
+      initsleeplock(&ip->lock, "inode");
+      ip->prev = icache.lru.prev;
+      ip->next = &icache.lru;
+      ip->prev->next = ip;
+      icache.lru.prev = ip;
+      icache.ninode++;
+    }
   }
 
   readsb(dev, &sb);
@@ -183,6 +382,9 @@ iinit(int dev)
  inodestart %d bmap start %d\n", sb.size, sb.nblocks,
           sb.ninodes, sb.nlog, sb.logstart, sb.inodestart,
           sb.bmapstart);
+  if(sb.bsize != BSIZE)
+    panic("iinit: file system block size is not BSIZE");
+  bgroupinit(dev);
 }
 
 static struct inode* iget(uint dev, uint inum);
@@ -190,7 +392,8 @@ static struct inode* iget(uint dev, uint inum);
 //PAGEBREAK!
 // Allocate an inode on device dev.
 // Mark it as allocated by  giving it type type.
-// Returns an unlocked but allocated and referenced inode.
+// Returns an unlocked but allocated and referenced inode,
+// or 0 if a tmpfs has run out of inodes.
 struct inode*
 ialloc(uint dev, short type)
 {
@@ -198,12 +401,18 @@ ialloc(uint dev, short type)
   struct buf *bp;
   struct dinode *dip;
 
+  if(dev == TMPDEV)
+    return (inum = tmpialloc(type)) ? iget(dev, inum) : 0;
   for(inum = 1; inum < sb.ninodes; inum++){
     bp = bread(dev, IBLOCK(inum, sb));
     dip = (struct dinode*)bp->data + inum%IPB;
     if(dip->type == 0){  // a free inode
       memset(dip, 0, sizeof(*dip));
       dip->type = type;
+      if(type == T_FILE && (sb.features & FS_INLINE))
+        dip->flags = I_INLINE;
+      else if(sb.features & FS_EXTENTS)
+        dip->flags = I_EXTENT;
       log_write(bp);   // mark it allocated on the disk
       brelse(bp);
       return iget(dev, inum);
@@ -223,6 +432,10 @@ iupdate(struct inode *ip)
   struct buf *bp;
   struct dinode *dip;
 
+  if(ip->dev == TMPDEV){
+    tmpiupdate(ip);
+    return;
+  }
   bp = bread(ip->dev, IBLOCK(ip->inum, sb));
   dip = (struct dinode*)bp->data + ip->inum%IPB;
   dip->type = ip->type;
@@ -230,42 +443,59 @@ iupdate(struct inode *ip)
   dip->minor = ip->minor;
   dip->nlink = ip->nlink;
   dip->size = ip->size;
+  dip->flags = ip->flags;
+  dip->prealloc = ip->prealloc;
   memmove(dip->addrs, ip->addrs, sizeof(ip->addrs));
   log_write(bp);
   brelse(bp);
 }
 
+static void
+lruremove(struct inode *ip)
+{
+  ip->prev->next = ip->next;
+  ip->next->prev = ip->prev;
+}
+
 // Find the inode with number inum on device dev
 // and return the in-memory copy. Does not lock
 // the inode and does not read it from disk.
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip, **pp;
 
   acquire(&icache.lock);
 
   // Is the inode already cached?
-  empty = 0;
-  for(ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
+  for(ip = icache.hash[IHASH(dev, inum)]; ip; ip = ip->hnext){
+    if(ip->dev == dev && ip->inum == inum){
+      if(ip->ref++ == 0)
+        lruremove(ip);
+      icache.hits++;
       release(&icache.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
+  icache.misses++;
 
-  // Recycle an inode cache entry.
-  if(empty == 0)
+  // Recycle the least recently used inode cache entry.
+  ip = icache.lru.next;
+  if(ip == &icache.lru)
     panic("iget: no inodes");
+  lruremove(ip);
+  if(ip->inum != 0){
+    for(pp = &icache.hash[IHASH(ip->dev, ip->inum)]; *pp != ip; pp = &(*pp)->hnext)
+      ;
+    *pp = ip->hnext;
+  }
 
-  ip = empty;
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  ip->hnext = icache.hash[IHASH(dev, inum)];
+  icache.hash[IHASH(dev, inum)] = ip;
   release(&icache.lock);
 
   return ip;
@@ -296,15 +526,23 @@ ilock(struct inode *ip)
   acquiresleep(&ip->lock);
 
   if(ip->valid == 0){
-    bp = bread(ip->dev, IBLOCK(ip->inum, sb));
-    dip = (struct dinode*)bp->data + ip->inum%IPB;
-    ip->type = dip->type;
-    ip->major = dip->major;
-    ip->minor = dip->minor;
-    ip->nlink = dip->nlink;
-    ip->size = dip->size;
-    memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
-    brelse(bp);
+    ip->prealloc = 0;
+    if(ip->dev == TMPDEV)
+      tmpiload(ip);
+    else {
+      bp = bread(ip->dev, IBLOCK(ip->inum, sb));
+      dip = (struct dinode*)bp->data + ip->inum%IPB;
+      ip->type = dip->type;
+      ip->major = dip->major;
+      ip->minor = dip->minor;
+      ip->nlink = dip->nlink;
+      ip->size = dip->size;
+      ip->flags = dip->flags;
+      ip->prealloc = dip->prealloc;
+      memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
+      brelse(bp);
+    }
+    ip->indaddr = 0;
     ip->valid = 1;
     if(ip->type == 0)
       panic("ilock: no type");
@@ -332,12 +570,17 @@ void
 iput(struct inode *ip)
 {
   acquiresleep(&ip->lock);
-  if(ip->valid && ip->nlink == 0){
+  if(ip->valid && (ip->nlink == 0 || ip->prealloc)){
     acquire(&icache.lock);
     int r = ip->ref;
     release(&icache.lock);
-    if(r == 1){
+    if(r == 1 && ip->nlink > 0){
+      // no other references: give back preallocated blocks.
+      etrim(ip);
+    } else if(r == 1){
       // inode has no links and no other references: truncate and free.
+      if(ip->type == T_DIR)
+        dcachepurge(ip->dev, ip->inum);
       itrunc(ip);
       ip->type = 0;
       iupdate(ip);
@@ -347,10 +590,24 @@ iput(struct inode *ip)
   releasesleep(&ip->lock);
 
   acquire(&icache.lock);
-  ip->ref--;
+  if(--ip->ref == 0){
+    // Most recently used goes last.
+    ip->prev = icache.lru.prev;
+    ip->next = &icache.lru;
+    ip->prev->next = ip;
+    icache.lru.prev = ip;
+  }
   release(&icache.lock);
 }
 
+// Print inode cache statistics to the console.
+void
+istatdump(void)
+{
+  cprintf("icache: %d inodes, %d hits, %d misses\n",
+          icache.ninode, icache.hits, icache.misses);
+}
+
 // Common idiom: unlock, then put.
 void
 iunlockput(struct inode *ip)
@@ -363,40 +620,398 @@ iunlockput(struct inode *ip)
 // Inode content
 //
 // The content (data) associated with each inode is stored
-// in blocks on the disk. The first NDIRECT block numbers
-// are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
+// in blocks on the disk.  In an extent-mapped inode (I_EXTENT),
+// ip->addrs[] holds extents, as described in fs.h.  Otherwise
+// the first NDIRECT block numbers are listed in ip->addrs[].
+// The next NINDIRECT blocks are listed in the singly indirect
+// block ip->addrs[NDIRECT], the next NDINDIRECT in the tree
+// under the doubly indirect block ip->addrs[NDIRECT+1], and
+// the next NTINDIRECT under the triply indirect block
+// ip->addrs[NDIRECT+2].
+//
+// A file of at most NINLINE bytes keeps its data in ip->addrs[]
+// instead (I_INLINE), which saves reading and allocating a
+// block; writei() moves the data to a block once it grows.
+//
+// Files only grow at the end, so a file's blocks are always
+// 0 to n-1, and emap() only has to allocate block n.
+
+// Return the last of the n extents at e with lblk <= bn.
+static struct extent*
+extfind(struct extent *e, int n, uint bn)
+{
+  int lo, hi, mid;
+
+  lo = 0;
+  hi = n - 1;
+  while(lo < hi){
+    mid = (lo + hi + 1) / 2;
+    if(e[mid].lblk <= bn)
+      lo = mid;
+    else
+      hi = mid - 1;
+  }
+  return &e[lo];
+}
+
+// Number of extents in use in ip->addrs[].
+static int
+extcount(struct inode *ip)
+{
+  struct extent *e;
+  int n;
+
+  e = (struct extent*)ip->addrs;
+  for(n = 0; n < NEXTENT && e[n].len > 0; n++)
+    ;
+  return n;
+}
+
+// Move the extents in ip->addrs[] out to a new extent block,
+// leaving a single index extent pointing to it.
+static void
+extsplit(struct inode *ip)
+{
+  struct extent *e;
+  struct extblock *eb;
+  struct buf *bp;
+  uint addr, len;
+  int n;
+
+  e = (struct extent*)ip->addrs;
+  n = extcount(ip);
+  len = e[n-1].lblk + e[n-1].len;
+  addr = balloc(ip->dev, 0);
+  bp = bread(ip->dev, addr);
+  eb = (struct extblock*)bp->data;
+  memmove(eb->e, e, n * sizeof(*e));
+  eb->n = n;
+  log_write(bp);
+  brelse(bp);
+
+  memset(e, 0, sizeof(ip->addrs));
+  e[0].lblk = 0;
+  e[0].pblk = addr;
+  e[0].len = len;
+  ip->flags |= I_EXTIDX;
+}
+
+#define PREALLOC 8  // blocks emap() maps at once as a file grows
+#define NRESERVE 4  // runs ireserve() maps per call
+
+// Allocate a run of up to want blocks for ip near goal and
+// set *run to its length.  Blocks of regular files are not
+// cleared, since nothing reads a file past its end.
+static uint
+brun(struct inode *ip, uint goal, uint want, uint *run)
+{
+  uint addr;
+
+  if(ip->type != T_FILE){
+    *run = 1;
+    return balloc(ip->dev, goal);
+  }
+  addr = bclaim(ip->dev, goal);
+  *run = 1 + bextend(ip->dev, addr + 1, want - 1);
+  return addr;
+}
+
+// Map block bn of extent-mapped ip, which must be the block
+// just past the last one mapped, to a new run of up to want
+// blocks.  Returns bn's disk block and sets *run to the
+// number of blocks mapped, or returns 0 if ip has no room
+// for another extent.
+static uint
+ealloc(struct inode *ip, uint bn, uint want, uint *run)
+{
+  struct extent *e, *x, *ix;
+  struct extblock *eb;
+  struct buf *bp;
+  uint addr;
+  int n;
+
+  e = (struct extent*)ip->addrs;
+  n = extcount(ip);
+  if(n > 0 && bn != e[n-1].lblk + e[n-1].len)
+    panic("emap: hole");
+  addr = 0;
+
+  if(!(ip->flags & I_EXTIDX)){
+    // Try for the disk block after the file's last one.
+    x = (n > 0) ? &e[n-1] : 0;
+    addr = brun(ip, x ? x->pblk + x->len : igoal(ip), want, run);
+    if(x && addr == x->pblk + x->len){
+      x->len += *run;
+      return addr;
+    }
+    if(n < NEXTENT){
+      e[n].lblk = bn;
+      e[n].pblk = addr;
+      e[n].len = *run;
+      return addr;
+    }
+    extsplit(ip);
+    n = 1;
+  }
+
+  ix = &e[n-1];
+  bp = bread(ip->dev, ix->pblk);
+  eb = (struct extblock*)bp->data;
+  x = &eb->e[eb->n-1];
+  if(addr == 0)
+    addr = brun(ip, x->pblk + x->len, want, run);
+  if(addr == x->pblk + x->len){
+    x->len += *run;
+  } else if(eb->n < NEXTBLK){
+    x = &eb->e[eb->n++];
+    x->lblk = bn;
+    x->pblk = addr;
+    x->len = *run;
+  } else {
+    // Start another extent block.
+    brelse(bp);
+    if(n == NEXTENT){
+      bfreerun(ip->dev, addr, *run);
+      return 0;
+    }
+    ix = &e[n];
+    ix->lblk = bn;
+    ix->pblk = balloc(ip->dev, 0);
+    bp = bread(ip->dev, ix->pblk);
+    eb = (struct extblock*)bp->data;
+    eb->n = 1;
+    eb->e[0].lblk = bn;
+    eb->e[0].pblk = addr;
+    eb->e[0].len = *run;
+  }
+  log_write(bp);
+  brelse(bp);
+  ix->len += *run;
+  return addr;
+}
+
+// bmap() for extent-mapped inodes.  A lookup costs a binary
+// search of the inode's extents, plus one of an extent block
+// once the file has more than NEXTENT extents.
+//
+// A regular file that grows gets PREALLOC blocks at a time,
+// so that files written concurrently still get long runs and
+// most appends do not touch the bitmap.  iput() gives back
+// the blocks the file did not use once it is no longer open.
+// The dinode records how many there are, so that blocks
+// preallocated before a crash go back the next time the
+// file is opened and closed.
+static uint
+emap(struct inode *ip, uint bn)
+{
+  struct extent *e, *x;
+  struct extblock *eb;
+  struct buf *bp;
+  uint addr, run;
+  int n;
+
+  e = (struct extent*)ip->addrs;
+  n = extcount(ip);
+  if(n > 0){
+    x = extfind(e, n, bn);
+    if(bn - x->lblk < x->len){
+      if(!(ip->flags & I_EXTIDX))
+        return x->pblk + bn - x->lblk;
+      bp = bread(ip->dev, x->pblk);
+      eb = (struct extblock*)bp->data;
+      x = extfind(eb->e, eb->n, bn);
+      addr = x->pblk + bn - x->lblk;
+      brelse(bp);
+      return addr;
+    }
+  }
+
+  if((addr = ealloc(ip, bn, ip->type == T_FILE ? PREALLOC : 1, &run)) == 0)
+    return 0;
+  ip->prealloc = run - 1;
+  return addr;
+}
+
+// Number of blocks extent-mapped ip maps.
+static uint
+eblocks(struct inode *ip)
+{
+  struct extent *e;
+  int n;
+
+  e = (struct extent*)ip->addrs;
+  n = extcount(ip);
+  return (n > 0) ? e[n-1].lblk + e[n-1].len : 0;
+}
+
+// Free the blocks emap() preallocated past the end of ip
+// that the file did not grow into.
+static void
+etrim(struct inode *ip)
+{
+  struct extent *e, *x, *ix;
+  struct extblock *eb;
+  struct buf *bp;
+  uint unused;
+  int n;
+
+  e = (struct extent*)ip->addrs;
+  n = extcount(ip);
+  unused = eblocks(ip) - (ip->size + BSIZE - 1) / BSIZE;
+  if(unused > ip->prealloc)
+    unused = ip->prealloc;  // the rest was reserved on purpose
+  ip->prealloc = 0;
+  if(n == 0 || unused == 0)
+    return;
+
+  ix = &e[n-1];
+  bp = 0;
+  x = ix;
+  if(ip->flags & I_EXTIDX){
+    bp = bread(ip->dev, ix->pblk);
+    eb = (struct extblock*)bp->data;
+    x = &eb->e[eb->n-1];
+  }
+  // emap() preallocates within a single run.
+  if(unused >= x->len)
+    panic("etrim");
+  x->len -= unused;
+  bfreerun(ip->dev, x->pblk + x->len, unused);
+  if(bp){
+    log_write(bp);
+    brelse(bp);
+    ix->len -= unused;
+  }
+  iupdate(ip);
+}
+
+// Map blocks past the end of regular file ip until it has
+// nblock, so that it can grow that far without allocating.
+// Maps at most NRESERVE runs, to fit in one OP_WRITE
+// transaction.  Returns how many blocks are still to be
+// mapped, or -1 if ip cannot have blocks reserved.
+// Caller must hold ip->lock.
+int
+ireserve(struct inode *ip, uint nblock)
+{
+  uint end, run;
+  int i;
+
+  if(ip->type != T_FILE || nblock > MAXEXTFILE)
+    return -1;
+  if(nblock == 0)
+    return 0;
+  if(ip->flags & I_INLINE)
+    iuninline(ip);
+  if(!(ip->flags & I_EXTENT))
+    return -1;
+
+  for(i = 0; i < NRESERVE && (end = eblocks(ip)) < nblock; i++)
+    if(ealloc(ip, end, nblock - end, &run) == 0)
+      break;
+  ip->prealloc = 0;  // keep it all
+  iupdate(ip);
+  if(i < NRESERVE && eblocks(ip) < nblock)
+    return -1;  // out of extents
+  end = eblocks(ip);
+  return end < nblock ? nblock - end : 0;
+}
+
+// Return entry i of indirect block addr,
+// allocating a block for it if it is empty.
+static uint
+indirect(struct inode *ip, uint addr, uint i)
+{
+  uint *a;
+  struct buf *bp;
+
+  bp = bread(ip->dev, addr);
+  a = (uint*)bp->data;
+  if(a[i] == 0){
+    a[i] = balloc(ip->dev, (i ? a[i-1] : addr) + 1);
+    log_write(bp);
+  }
+  addr = a[i];
+  brelse(bp);
+  return addr;
+}
 
 // Return the disk block address of the nth block in inode ip.
-// If there is no such block, bmap allocates one.
+// If there is no such block, bmap allocates one.  Returns 0
+// if an extent-mapped ip has no room to map another block.
 static uint
 bmap(struct inode *ip, uint bn)
 {
-  uint addr, *a;
-  struct buf *bp;
+  uint addr, base, span, i;
+  int level;
+
+  if(ip->flags & I_INLINE)
+    panic("bmap: inline");
+  if(ip->flags & I_EXTENT)
+    return emap(ip, bn);
 
   if(bn < NDIRECT){
     if((addr = ip->addrs[bn]) == 0)
-      ip->addrs[bn] = addr = balloc(ip->dev);
+      ip->addrs[bn] = addr = balloc(ip->dev, bn ? ip->addrs[bn-1] + 1 : igoal(ip));
     return addr;
   }
   bn -= NDIRECT;
 
-  if(bn < NINDIRECT){
-    // Load indirect block, allocating if necessary.
-    if((addr = ip->addrs[NDIRECT]) == 0)
-      ip->addrs[NDIRECT] = addr = balloc(ip->dev);
-    bp = bread(ip->dev, addr);
-    a = (uint*)bp->data;
-    if((addr = a[bn]) == 0){
-      a[bn] = addr = balloc(ip->dev);
-      log_write(bp);
-    }
-    brelse(bp);
-    return addr;
+  // Sequential access keeps using the same last-level
+  // indirect block, so skip the walk down to it.
+  if(ip->indaddr && bn - ip->indbase < NINDIRECT)
+    return indirect(ip, ip->indaddr, bn - ip->indbase);
+
+  // Find the tree that maps bn: level 0 is the singly
+  // indirect block, 1 the doubly, 2 the triply indirect.
+  base = 0;
+  span = 1;
+  for(level = 0; level < 3; level++){
+    span *= NINDIRECT;  // blocks mapped by this tree
+    if(bn - base < span)
+      break;
+    base += span;
   }
+  if(level == 3)
+    panic("bmap: out of range");
+
+  // Load the top indirect block, allocating if necessary,
+  // and walk down to the last level.
+  if((addr = ip->addrs[NDIRECT+level]) == 0)
+    ip->addrs[NDIRECT+level] = addr = balloc(ip->dev, ip->addrs[NDIRECT+level-1] + 1);
+  i = bn - base;
+  while(span > NINDIRECT){
+    span /= NINDIRECT;
+    addr = indirect(ip, addr, i / span);
+    i %= span;
+  }
+  ip->indaddr = addr;
+  ip->indbase = bn - i;
+  return indirect(ip, addr, i);
+}
 
-  panic("bmap: out of range");
+// Free indirect block addr and the blocks it points to.
+// Those are data blocks at level 0, otherwise indirect
+// blocks one level down.
+static void
+indfree(uint dev, uint addr, int level)
+{
+  struct buf *bp;
+  uint *a;
+  int j;
+
+  bp = bread(dev, addr);
+  a = (uint*)bp->data;
+  for(j = 0; j < NINDIRECT; j++){
+    if(a[j] == 0)
+      continue;
+    if(level > 0)
+      indfree(dev, a[j], level-1);
+    else
+      bfree(dev, a[j]);
+  }
+  brelse(bp);
+  bfree(dev, addr);
 }
 
 // Truncate inode (discard contents).
@@ -407,9 +1022,41 @@ bmap(struct inode *ip, uint bn)
 static void
 itrunc(struct inode *ip)
 {
-  int i, j;
+  int i, j, n;
   struct buf *bp;
-  uint *a;
+  struct extent *e;
+  struct extblock *eb;
+
+  if(ip->dev == TMPDEV)
+    tmptrunc(ip);
+  if(ip->dev == TMPDEV || (ip->flags & I_INLINE)){
+    memset(ip->addrs, 0, sizeof(ip->addrs));
+    ip->size = 0;
+    iupdate(ip);
+    return;
+  }
+
+  if(ip->flags & I_EXTENT){
+    e = (struct extent*)ip->addrs;
+    n = extcount(ip);
+    for(i = 0; i < n; i++){
+      if(ip->flags & I_EXTIDX){
+        bp = bread(ip->dev, e[i].pblk);
+        eb = (struct extblock*)bp->data;
+        for(j = 0; j < eb->n; j++)
+          bfreerun(ip->dev, eb->e[j].pblk, eb->e[j].len);
+        brelse(bp);
+        bfree(ip->dev, e[i].pblk);
+      } else
+        bfreerun(ip->dev, e[i].pblk, e[i].len);
+    }
+    memset(ip->addrs, 0, sizeof(ip->addrs));
+    ip->flags &= ~I_EXTIDX;
+    ip->prealloc = 0;
+    ip->size = 0;
+    iupdate(ip);
+    return;
+  }
 
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
@@ -418,17 +1065,13 @@ itrunc(struct inode *ip)
     }
   }
 
-  if(ip->addrs[NDIRECT]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
-    a = (uint*)bp->data;
-    for(j = 0; j < NINDIRECT; j++){
-      if(a[j])
-        bfree(ip->dev, a[j]);
+  for(i = 0; i < 3; i++){
+    if(ip->addrs[NDIRECT+i]){
+      indfree(ip->dev, ip->addrs[NDIRECT+i], i);
+      ip->addrs[NDIRECT+i] = 0;
     }
-    brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
-    ip->addrs[NDIRECT] = 0;
   }
+  ip->indaddr = 0;
 
   ip->size = 0;
   iupdate(ip);
@@ -466,6 +1109,13 @@ readi(struct inode *ip, char *dst, uint off, uint n)
   if(off + n > ip->size)
     n = ip->size - off;
 
+  if(ip->dev == TMPDEV)
+    return tmpread(ip, dst, off, n);
+  if(ip->flags & I_INLINE){
+    memmove(dst, (char*)ip->addrs + off, n);
+    return n;
+  }
+
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
     bp = bread(ip->dev, bmap(ip, off/BSIZE));
     m = min(n - tot, BSIZE - off%BSIZE);
@@ -475,14 +1125,47 @@ readi(struct inode *ip, char *dst, uint off, uint n)
   return n;
 }
 
+// Move the data of inline inode ip out to a block of its
+// own, to make room for more.
+static void
+iuninline(struct inode *ip)
+{
+  char data[NINLINE];
+  struct buf *bp;
+
+  memmove(data, ip->addrs, NINLINE);
+  memset(ip->addrs, 0, sizeof(ip->addrs));
+  ip->flags &= ~I_INLINE;
+  if(sb.features & FS_EXTENTS)
+    ip->flags |= I_EXTENT;
+  if(ip->size > 0){
+    bp = bread(ip->dev, bmap(ip, 0));
+    memmove(bp->data, data, ip->size);
+    log_write(bp);
+    brelse(bp);
+  }
+  iupdate(ip);
+}
+
 // PAGEBREAK!
-// Write data to inode.
-// Caller must hold ip->lock.
-int
-writei(struct inode *ip, char *src, uint off, uint n)
+// Most log blocks that writing one more block of a file can
+// take: two bitmap blocks, an extent block and a new one,
+// the data block itself and the inode.  No more than
+// OP_WRITE, so that stopping when the log has less room
+// than this never needs more than the op reserved.
+#define BLOCKCOST 6
+
+// Write data to inode.  If bulk, write blocks past the end of
+// the file straight to disk where log_ordered() allows, and
+// stop early, once at least one block is written, when the
+// log has no room for another.  Return bytes written, which
+// are fewer than n if ip runs out of extents, or -1.
+static int
+iwrite(struct inode *ip, char *src, uint off, uint n, int bulk)
 {
-  uint tot, m;
+  uint tot, m, addr;
   struct buf *bp;
+  int fresh;
 
   if(ip->type == T_DEV){
     if(ip->major < 0 || ip->major >= NDEV || !devsw[ip->major].write)
@@ -492,22 +1175,66 @@ writei(struct inode *ip, char *src, uint off, uint n)
 
   if(off > ip->size || off + n < off)
     return -1;
-  if(off + n > MAXFILE*BSIZE)
+  if(ip->dev == TMPDEV)
+    return tmpwrite(ip, src, off, n);
+  if(off + n > ((ip->flags & I_EXTENT) ? MAXEXTFILE : MAXFILE)*BSIZE)
     return -1;
 
+  if(ip->flags & I_INLINE){
+    if(off + n > NINLINE)
+      iuninline(ip);
+    else {
+      memmove((char*)ip->addrs + off, src, n);
+      if(off + n > ip->size)
+        ip->size = off + n;
+      iupdate(ip);
+      return n;
+    }
+  }
+
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
+    if(bulk && tot > 0 && log_room() < BLOCKCOST)
+      break;
+    // A block that starts at or past the end of the file
+    // holds nothing worth reading.
+    fresh = off%BSIZE == 0 && off >= ip->size;
+    if((addr = bmap(ip, off/BSIZE)) == 0)
+      break;  // out of extents
+    if(fresh)
+      bp = bnew(ip->dev, addr);
+    else
+      bp = bread(ip->dev, addr);
     m = min(n - tot, BSIZE - off%BSIZE);
     memmove(bp->data + off%BSIZE, src, m);
-    log_write(bp);
+    if(bulk && fresh && log_ordered(bp))
+      bwrite(bp);
+    else
+      log_write(bp);
     brelse(bp);
   }
 
-  if(n > 0 && off > ip->size){
+  if(tot > 0 && off > ip->size){
     ip->size = off;
     iupdate(ip);
   }
-  return n;
+  return (tot == 0 && n > 0) ? -1 : tot;
+}
+
+// Write data to inode, all of it.
+// Caller must hold ip->lock.
+int
+writei(struct inode *ip, char *src, uint off, uint n)
+{
+  return iwrite(ip, src, off, n, 0);
+}
+
+// Write as much data to inode as one transaction allows,
+// however much that is, keeping new blocks out of the log.
+// Caller must hold ip->lock, in a transaction.
+int
+writeibulk(struct inode *ip, char *src, uint off, uint n)
+{
+  return iwrite(ip, src, off, n, 1);
 }
 
 //PAGEBREAK!
@@ -519,34 +1246,266 @@ namecmp(const char *s, const char *t)
   return strncmp(s, t, DIRSIZ);
 }
 
+// Bucket splits OP_LINK reserves log space for.  dirlink()
+// splits further only while log_room() allows SPLITCOST more.
+#define DIRSPLITS 1
+#define SPLITCOST 6   // new and old bucket, index, inode, bitmap, extent
+
+// Hash of a name, for hashed directories.  mkfs.c has a copy.
+static uint
+dirhash(char *name)
+{
+  uint h;
+  int i;
+
+  h = 2166136261;  // FNV-1a
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = (h ^ (uchar)name[i]) * 16777619;
+  return h;
+}
+
+static int
+isdots(char *name)
+{
+  return namecmp(name, ".") == 0 || namecmp(name, "..") == 0;
+}
+
+// Look for name among the first n dirents of block bn of
+// directory dp.  Return its inum and set *poff, or return 0.
+static uint
+dirfind(struct inode *dp, uint bn, uint n, char *name, uint *poff)
+{
+  struct buf *bp;
+  struct dirent *de;
+  uint inum;
+
+  inum = 0;
+  bp = bread(dp->dev, bmap(dp, bn));
+  for(de = (struct dirent*)bp->data; de < (struct dirent*)bp->data + n; de++){
+    if(de->inum != 0 && namecmp(name, de->name) == 0){
+      inum = de->inum;
+      *poff = bn*BSIZE + (uchar*)de - bp->data;
+      break;
+    }
+  }
+  brelse(bp);
+  return inum;
+}
+
+// Search flat directory dp, through readi(), for name.
+// Return its inum and set *poff, or return 0.
+static uint
+dirscan(struct inode *dp, char *name, uint *poff)
+{
+  struct dirent de;
+  uint off;
+
+  for(off = 0; off < dp->size; off += sizeof(de)){
+    if(readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
+      panic("dirscan read");
+    if(de.inum != 0 && namecmp(name, de.name) == 0){
+      *poff = off;
+      return de.inum;
+    }
+  }
+  return 0;
+}
+
+// Return the bucket of hashed directory dp that holds name.
+static uint
+dirbucket(struct inode *dp, char *name)
+{
+  struct buf *bp;
+  struct dirhead *dh;
+  uint bn;
+
+  bp = bread(dp->dev, bmap(dp, 0));
+  dh = (struct dirhead*)bp->data + 2;
+  bn = DIRBUCKET(bp->data, dirhash(name) & ((1 << dh->depth) - 1));
+  brelse(bp);
+  if(bn == 0 || bn >= dp->size / BSIZE)
+    panic("dirbucket");
+  return bn;
+}
+
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
 struct inode*
 dirlookup(struct inode *dp, char *name, uint *poff)
 {
-  uint off, inum;
-  struct dirent de;
+  uint bn, off, inum;
 
   if(dp->type != T_DIR)
     panic("dirlookup not DIR");
 
-  for(off = 0; off < dp->size; off += sizeof(de)){
-    if(readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
-      panic("dirlookup read");
-    if(de.inum == 0)
-      continue;
-    if(namecmp(name, de.name) == 0){
-      // entry matches path element
-      if(poff)
-        *poff = off;
-      inum = de.inum;
-      return iget(dp->dev, inum);
-    }
+  if(dcachelookup(dp, name, &inum, &off)){
+    if(inum == 0)
+      return 0;
+    if(poff)
+      *poff = off;
+    return iget(dp->dev, inum);
   }
 
+  if(dp->dev == TMPDEV)
+    inum = dirscan(dp, name, &off);
+  else if(dp->flags & I_DIRHASH){
+    if(isdots(name))
+      inum = dirfind(dp, 0, 2, name, &off);
+    else
+      inum = dirfind(dp, dirbucket(dp, name), NDIRENT, name, &off);
+  } else {
+    inum = 0;
+    for(bn = 0; inum == 0 && bn*BSIZE < dp->size; bn++)
+      inum = dirfind(dp, bn, min(dp->size - bn*BSIZE, BSIZE) / sizeof(struct dirent),
+                     name, &off);
+  }
+
+  if(inum == 0){
+    dcacheenter(dp, name, 0, 0);
+    return 0;
+  }
+  // entry matches path element
+  dcacheenter(dp, name, inum, off);
+  if(poff)
+    *poff = off;
+  return iget(dp->dev, inum);
+}
+
+// Turn flat directory dp, whose one block is full,
+// into a hashed directory with two buckets.
+static void
+dirconvert(struct inode *dp)
+{
+  struct buf *hp, *bp[2];
+  struct dirent *de, *ne[2];
+  struct dirhead *dh;
+  int i;
+
+  hp = bread(dp->dev, bmap(dp, 0));
+  de = (struct dirent*)hp->data;
+  if(namecmp(de[0].name, ".") != 0 || namecmp(de[1].name, "..") != 0)
+    panic("dirconvert");
+  for(i = 0; i < 2; i++){
+    bp[i] = bread(dp->dev, bmap(dp, 1 + i));
+    ne[i] = (struct dirent*)bp[i]->data;
+  }
+  for(de += 2; de < (struct dirent*)hp->data + NDIRENT; de++){
+    if(de->inum != 0)
+      *ne[dirhash(de->name) & 1]++ = *de;
+    memset(de, 0, sizeof(*de));
+  }
+  dh = (struct dirhead*)hp->data + 2;
+  dh->depth = 1;
+  DIRBUCKET(hp->data, 0) = 1;
+  DIRBUCKET(hp->data, 1) = 2;
+  for(i = 0; i < 2; i++){
+    log_write(bp[i]);
+    brelse(bp[i]);
+  }
+  log_write(hp);
+  brelse(hp);
+
+  dp->size = 3*BSIZE;
+  dp->flags |= I_DIRHASH;
+  iupdate(dp);
+  dcachepurge(dp->dev, dp->inum);  // entries moved
+}
+
+// Split the bucket that name hashes to in hashed directory
+// dp, moving the entries whose next hash bit is set into a
+// new bucket at the end of dp, and doubling the index first
+// if only one index entry points at the bucket.
+// Return -1 if the index or dp cannot grow any more.
+static int
+dirsplit(struct inode *dp, char *name)
+{
+  struct buf *hp, *bp, *np;
+  struct dirhead *dh;
+  struct dirent *de, *ne;
+  uint bn, nb, addr, i, n, cnt, bit;
+
+  hp = bread(dp->dev, bmap(dp, 0));
+  dh = (struct dirhead*)hp->data + 2;
+  n = 1 << dh->depth;
+  bn = DIRBUCKET(hp->data, dirhash(name) & (n - 1));
+  cnt = 0;
+  for(i = 0; i < n; i++)
+    if(DIRBUCKET(hp->data, i) == bn)
+      cnt++;
+  nb = dp->size / BSIZE;
+  if((cnt == 1 && 2*n > NDIRINDEX) || (addr = bmap(dp, nb)) == 0){
+    brelse(hp);
+    return -1;
+  }
+  if(cnt == 1){
+    for(i = 0; i < n; i++)
+      DIRBUCKET(hp->data, n + i) = DIRBUCKET(hp->data, i);
+    dh->depth++;
+    n *= 2;
+    cnt = 2;
+  }
+  // The bucket's entries agree in their low n/cnt hash
+  // bits; split on the next one.
+  bit = n / cnt;
+
+  np = bread(dp->dev, addr);
+  dp->size += BSIZE;
+  iupdate(dp);
+  bp = bread(dp->dev, bmap(dp, bn));
+  ne = (struct dirent*)np->data;
+  for(de = (struct dirent*)bp->data; de < (struct dirent*)bp->data + NDIRENT; de++){
+    if(de->inum != 0 && (dirhash(de->name) & bit)){
+      *ne++ = *de;
+      memset(de, 0, sizeof(*de));
+    }
+  }
+  for(i = 0; i < n; i++)
+    if(DIRBUCKET(hp->data, i) == bn && (i & bit))
+      DIRBUCKET(hp->data, i) = nb;
+  log_write(np);
+  brelse(np);
+  log_write(bp);
+  brelse(bp);
+  log_write(hp);
+  brelse(hp);
+  dcachepurge(dp->dev, dp->inum);  // entries moved
   return 0;
 }
 
+// Add (name, inum) to hashed directory dp.  If the name's
+// bucket is full, split it until there is room.  Return -1
+// if the index cannot grow or the log has no room for
+// another split.
+static int
+dirhashlink(struct inode *dp, char *name, uint inum)
+{
+  struct buf *bp;
+  struct dirent *de;
+  uint bn, off;
+  int tries;
+
+  for(tries = 0; ; tries++){
+    bn = dirbucket(dp, name);
+    bp = bread(dp->dev, bmap(dp, bn));
+    for(de = (struct dirent*)bp->data; de < (struct dirent*)bp->data + NDIRENT; de++){
+      if(de->inum == 0){
+        strncpy(de->name, name, DIRSIZ);
+        de->inum = inum;
+        off = bn*BSIZE + (uchar*)de - bp->data;
+        log_write(bp);
+        brelse(bp);
+        dcacheenter(dp, name, inum, off);
+        return 0;
+      }
+    }
+    brelse(bp);
+    if(tries >= DIRSPLITS && log_room() < SPLITCOST)
+      return -1;
+    if(dirsplit(dp, name) < 0)
+      return -1;
+  }
+}
+
 // Write a new directory entry (name, inum) into the directory dp.
 int
 dirlink(struct inode *dp, char *name, uint inum)
@@ -561,6 +1520,9 @@ dirlink(struct inode *dp, char *name, uint inum)
     return -1;
   }
 
+  if(dp->flags & I_DIRHASH)
+    return dirhashlink(dp, name, inum);
+
   // Look for an empty dirent.
   for(off = 0; off < dp->size; off += sizeof(de)){
     if(readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
@@ -569,10 +1531,22 @@ dirlink(struct inode *dp, char *name, uint inum)
       break;
   }
 
+  // Rather than grow past one block, become hashed.
+  // Directories made flat by older kernels stay flat,
+  // as do tmpfs directories.
+  if(off == BSIZE && dp->size == BSIZE && dp->dev != TMPDEV){
+    dirconvert(dp);
+    return dirhashlink(dp, name, inum);
+  }
+
   strncpy(de.name, name, DIRSIZ);
   de.inum = inum;
-  if(writei(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
+  if(writei(dp, (char*)&de, off, sizeof(de)) != sizeof(de)){
+    if(dp->dev == TMPDEV)
+      return -1;  // out of tmpfs pages
     panic("dirlink");
+  }
+  dcacheenter(dp, name, inum, off);
 
   return 0;
 }
@@ -617,14 +1591,92 @@ skipelem(char *path, char *name)
   return path;
 }
 
+// Mount the file system whose root directory is root on
+// directory on, taking over the caller's references to both.
+// Return -1 if on is the root or already has something
+// mounted on it, or the table is full.
+int
+mount(struct inode *on, struct inode *root)
+{
+  int i, slot;
+
+  if(on->dev == ROOTDEV && on->inum == ROOTINO)
+    return -1;
+  acquire(&mtab.lock);
+  slot = -1;
+  for(i = 0; i < NMOUNT; i++){
+    if(mtab.m[i].on == on || mtab.m[i].root == on){
+      release(&mtab.lock);
+      return -1;
+    }
+    if(mtab.m[i].on == 0 && slot < 0)
+      slot = i;
+  }
+  if(slot >= 0){
+    mtab.m[slot].on = on;
+    mtab.m[slot].root = root;
+  }
+  release(&mtab.lock);
+  return slot >= 0 ? 0 : -1;
+}
+
+// If something is mounted on ip, return a new
+// reference to its root, otherwise 0.
+static struct inode*
+mountroot(struct inode *ip)
+{
+  struct inode *root;
+  int i;
+
+  root = 0;
+  acquire(&mtab.lock);
+  for(i = 0; i < NMOUNT; i++)
+    if(mtab.m[i].on == ip)
+      root = mtab.m[i].root;
+  release(&mtab.lock);
+  return root ? idup(root) : 0;
+}
+
+// If ip is the root of a mounted file system, return a
+// new reference to the directory it is mounted on,
+// otherwise 0.
+static struct inode*
+mountedon(struct inode *ip)
+{
+  struct inode *on;
+  int i;
+
+  on = 0;
+  acquire(&mtab.lock);
+  for(i = 0; i < NMOUNT; i++)
+    if(mtab.m[i].on && mtab.m[i].root == ip)
+      on = mtab.m[i].on;
+  release(&mtab.lock);
+  return on ? idup(on) : 0;
+}
+
+// Is a file system mounted on ip?
+int
+ismountpoint(struct inode *ip)
+{
+  struct inode *root;
+
+  if((root = mountroot(ip)) == 0)
+    return 0;
+  iput(root);
+  return 1;
+}
+
 // Look up and return the inode for a path name.
 // If parent != 0, return the inode for the parent and copy the final
 // path element into name, which must have room for DIRSIZ bytes.
 // Must be called inside a transaction since it calls iput().
+// Crosses into a mounted file system on the way down, and out
+// of it again at ".." in its root.
 static struct inode*
 namex(char *path, int nameiparent, char *name)
 {
-  struct inode *ip, *next;
+  struct inode *ip, *next, *mp;
 
   if(*path == '/')
     ip = iget(ROOTDEV, ROOTINO);
@@ -642,11 +1694,20 @@ namex(char *path, int nameiparent, char *name)
       iunlock(ip);
       return ip;
     }
+    if(namecmp(name, "..") == 0 && (mp = mountedon(ip)) != 0){
+      iunlockput(ip);
+      ip = mp;
+      ilock(ip);
+    }
     if((next = dirlookup(ip, name, 0)) == 0){
       iunlockput(ip);
       return 0;
     }
     iunlockput(ip);
+    if((mp = mountroot(next)) != 0){
+      iput(next);
+      next = mp;
+    }
     ip = next;
   }
   if(nameiparent){
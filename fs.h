@@ -3,7 +3,9 @@
 
 
 #define ROOTINO 1  // root i-number
-#define BSIZE 512  // block size
+#ifndef BSIZE
+#define BSIZE 4096  // block size; the kernel and mkfs must agree
+#endif
 
 // Disk layout:
 // [ boot block | super block | log | inode blocks |
@@ -19,11 +21,20 @@ struct superblock {
   uint logstart;     // Block number of first log block
   uint inodestart;   // Block number of first inode block
   uint bmapstart;    // Block number of first free map block
+  uint bsize;        // Block size (bytes)
+  uint features;     // FS_* flags
 };
 
-#define NDIRECT 12
+#define FS_EXTENTS 0x1  // ialloc() makes extent-mapped inodes
+#define FS_INLINE  0x2  // ... and keeps small files' data inline
+#define FS_ASYNC   0x4  // log commits on a timer, not at each op's end
+
+#define NDIRECT 9
 #define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+#define NDINDIRECT (NINDIRECT * NINDIRECT)
+#define NTINDIRECT (NDINDIRECT * NINDIRECT)
+#define MAXMAPPED (NDIRECT + NINDIRECT + NDINDIRECT + NTINDIRECT)
+#define MAXFILE (MAXMAPPED < MAXEXTFILE ? MAXMAPPED : MAXEXTFILE)
 
 // On-disk inode structure
 struct dinode {
@@ -32,9 +43,44 @@ struct dinode {
   short minor;          // Minor device number (T_DEV only)
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
-  uint addrs[NDIRECT+1];   // Data block addresses
+  ushort flags;         // I_* flags
+  ushort prealloc;      // blocks mapped ahead of need; see emap()
+  uint addrs[NDIRECT+3];   // Data block addresses, or extents
+};
+
+#define I_EXTENT  0x1  // addrs[] holds extents, not block addresses
+#define I_EXTIDX  0x2  // ... which point to blocks of extents
+#define I_DIRHASH 0x4  // directory is hashed; see struct dirhead
+#define I_INLINE  0x8  // addrs[] holds the file's data itself
+
+// Largest file whose data fits in addrs[].
+#define NINLINE sizeof(((struct dinode*)0)->addrs)
+
+// An extent maps len consecutive blocks of a file, starting at
+// file block lblk, onto len consecutive disk blocks starting at
+// pblk.  An extent-mapped inode holds up to NEXTENT extents in
+// addrs[], sorted by lblk.  When they run out, they move to an
+// extent block and addrs[] holds index extents instead, each
+// giving the range of file blocks that one extent block maps.
+struct extent {
+  uint lblk;
+  uint pblk;
+  uint len;       // 0 if unused
 };
 
+#define NEXTENT (sizeof(((struct dinode*)0)->addrs) / sizeof(struct extent))
+
+struct extblock {
+  uint n;         // extents in use
+  uint pad[2];
+  struct extent e[(BSIZE - 3*sizeof(uint)) / sizeof(struct extent)];
+};
+
+#define NEXTBLK (sizeof(((struct extblock*)0)->e) / sizeof(struct extent))
+
+// Largest file, in blocks, that the size field allows.
+#define MAXEXTFILE (0xFFFFFFFF / BSIZE)
+
 // Inodes per block.
 #define IPB           (BSIZE / sizeof(struct dinode))
 
@@ -55,3 +101,34 @@ struct dirent {
   char name[DIRSIZ];
 };
 
+#define NDIRENT (BSIZE / sizeof(struct dirent))  // dirents per block
+
+// A directory that outgrows its first block becomes hashed
+// (I_DIRHASH).  Each later block is then a bucket of dirents,
+// and block 0 keeps "." and ".." in its first two dirents
+// followed by an index: a struct dirhead, then struct dirindex
+// records giving the bucket for each of the 1<<depth values of
+// the low bits of dirhash(name).  A bucket may serve several
+// index entries; when it fills up it is split in two, doubling
+// the index first if need be.  The index records begin with
+// a zero inum, so programs that read a directory as an array
+// of struct dirent, like ls, see only empty entries there.
+struct dirhead {
+  ushort inum;    // always 0
+  ushort depth;   // the index has 1<<depth entries
+  char pad[DIRSIZ-sizeof(ushort)];
+};
+
+#define NDIRPTR 7
+struct dirindex {
+  ushort inum;              // always 0
+  ushort bucket[NDIRPTR];   // directory block numbers
+};
+
+// Index entries block 0 has room for.
+#define NDIRINDEX ((NDIRENT - 3) * NDIRPTR)
+
+// Bucket for index entry i, given block 0's data.
+#define DIRBUCKET(p, i) \
+  (((struct dirindex*)(p) + 3 + (i)/NDIRPTR)->bucket[(i)%NDIRPTR])
+
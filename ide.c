@@ -1,4 +1,6 @@
-// Simple PIO-based (non-DMA) IDE driver code.
+// IDE disk driver.
+// Transfers use bus-master DMA through the PCI IDE controller
+// when there is one, and fall back to programmed I/O otherwise.
 
 #include "types.h"
 #include "defs.h"
@@ -12,8 +14,10 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "pci.h"
 
 #define SECTOR_SIZE   512
+#define MAXMULTIPLE   16   // most sectors per READ/WRITE MULTIPLE interrupt
 #define IDE_BSY       0x80
 #define IDE_DRDY      0x40
 #define IDE_DF        0x20
@@ -23,16 +27,54 @@
 #define IDE_CMD_WRITE 0x30
 #define IDE_CMD_RDMUL 0xc4
 #define IDE_CMD_WRMUL 0xc5
+#define IDE_CMD_SETMUL 0xc6
+#define IDE_CMD_RDDMA 0xc8
+#define IDE_CMD_WRDMA 0xca
+#define IDE_CMD_IDENTIFY 0xec
+
+// Bus master IDE registers, relative to the I/O base
+// in BAR4 of the controller; the primary channel is first.
+#define BM_CMD        0x0
+#define BM_STATUS     0x2
+#define BM_PRDT       0x4
+
+#define BM_CMD_START  0x01  // start transfer
+#define BM_CMD_READ   0x08  // transfer from disk to memory
+#define BM_STATUS_ERR  0x02
+#define BM_STATUS_INTR 0x04
+
+// Physical region descriptor: one physically contiguous
+// piece of a DMA transfer.  A region must not cross
+// a 64KB boundary; count 0 means 64KB.
+struct prd {
+  uint addr;
+  ushort count;
+  ushort flags;
+};
+#define PRD_EOT 0x8000  // last descriptor in the table
+
+// Enough descriptors for a block split at every 64KB boundary.
+#define NPRD ((BSIZE + 0xffff) / 0x10000 + 1)
 
 // idequeue points to the buf now being read/written to the disk.
-// idequeue->qnext points to the next buf to be processed.
-// You must hold idelock while manipulating queue.
+// Requests waiting for the disk are held by the I/O scheduler
+// (iosched.c), which picks the next one to start.
+// You must hold idelock while manipulating either.
 
 static struct spinlock idelock;
 static struct buf *idequeue;
 
 static int havedisk1;
+static uint disksize;   // blocks on disk 1
 static void idestart(struct buf*);
+static void idedmainit(void);
+static void idedisk1init(void);
+
+// The PRD table itself must not cross a 64KB boundary either;
+// aligning it to a power of two at least its size ensures that.
+static struct prd prdt[NPRD] __attribute__((aligned(64)));
+static ushort bmbase;   // bus master I/O base; 0 means PIO only
+static int dmaactive;   // idequeue is being transferred by DMA
 
 // Wait for IDE disk to become ready.
 static int
@@ -53,6 +95,7 @@ ideinit(void)
   int i;
 
   initlock(&idelock, "ide");
+  ioschedinit();
   ioapicenable(IRQ_IDE, ncpu - 1);
   idewait(0);
 
@@ -65,8 +108,75 @@ ideinit(void)
     }
   }
 
+  if(havedisk1)
+    idedisk1init();
+
   // Switch back to disk 0.
   outb(0x1f6, 0xe0 | (0<<4));
+
+  idedmainit();
+}
+
+// Find out how big disk 1 is, and have it move a whole
+// block per interrupt with READ/WRITE MULTIPLE.
+// Leaves disk 1 selected.
+static void
+idedisk1init(void)
+{
+  ushort id[256];
+
+  outb(0x1f6, 0xe0 | (1<<4));
+  idewait(0);
+  outb(0x1f7, IDE_CMD_IDENTIFY);
+  idewait(0);
+  insl(0x1f0, id, sizeof(id)/4);
+  disksize = (id[60] | (id[61] << 16)) / (BSIZE/SECTOR_SIZE);  // LBA28 sectors
+  cprintf("ide: disk 1 has %d blocks\n", disksize);
+
+  if(BSIZE/SECTOR_SIZE > MAXMULTIPLE)
+    panic("ideinit: BSIZE too big");
+  if(BSIZE > SECTOR_SIZE){
+    outb(0x1f2, BSIZE/SECTOR_SIZE);
+    outb(0x1f7, IDE_CMD_SETMUL);
+    idewait(0);
+  }
+}
+
+// Look for a PCI IDE controller capable of bus-master DMA
+// and set bmbase if there is one.
+static void
+idedmainit(void)
+{
+  struct pcidev d;
+
+  if(pcifind(PCI_ANY, PCI_ANY, PCI_CLASS_STORAGE, PCI_SUBCLASS_IDE, &d) < 0)
+    return;
+  if((d.progif & 0x80) == 0 || (d.bar[4] & PCI_BAR_IO) == 0)
+    return;
+  pcienable(&d);
+  bmbase = d.bar[4] & ~3;
+  cprintf("ide: bus-master dma at 0x%x\n", bmbase);
+}
+
+// Point the PRD table at b->data, which the kernel maps
+// one-to-one onto physical memory.
+static void
+idedmaprep(struct buf *b)
+{
+  struct prd *p;
+  uint pa, n, m;
+
+  pa = V2P(b->data);
+  p = prdt;
+  for(n = BSIZE; n > 0; n -= m, pa += m, p++){
+    m = 0x10000 - (pa & 0xffff);
+    if(m > n)
+      m = n;
+    p->addr = pa;
+    p->count = m & 0xffff;
+    p->flags = 0;
+  }
+  (p-1)->flags = PRD_EOT;
 }
 
 // Start the request for b.  Caller must hold idelock.
@@ -75,15 +185,13 @@ idestart(struct buf *b)
 {
   if(b == 0)
     panic("idestart");
-  if(b->blockno >= FSSIZE)
+  if(b->blockno >= disksize)
     panic("incorrect blockno");
   int sector_per_block =  BSIZE/SECTOR_SIZE;
   int sector = b->blockno * sector_per_block;
   int read_cmd = (sector_per_block == 1) ? IDE_CMD_READ :  IDE_CMD_RDMUL;
   int write_cmd = (sector_per_block == 1) ? IDE_CMD_WRITE : IDE_CMD_WRMUL;
 
-  if (sector_per_block > 7) panic("idestart");
-
   idewait(0);
   outb(0x3f6, 0);  // generate interrupt
   outb(0x1f2, sector_per_block);  // number of sectors
@@ -91,6 +199,23 @@ idestart(struct buf *b)
   outb(0x1f4, (sector >> 8) & 0xff);
   outb(0x1f5, (sector >> 16) & 0xff);
   outb(0x1f6, 0xe0 | ((b->dev&1)<<4) | ((sector>>24)&0x0f));
+  if(bmbase){
+    // The controller moves the data; ideintr() only
+    // has to acknowledge completion.
+    idedmaprep(b);
+    outb(bmbase + BM_CMD, 0);
+    outl(bmbase + BM_PRDT, V2P(prdt));
+    outb(bmbase + BM_STATUS, BM_STATUS_ERR | BM_STATUS_INTR);
+    if(b->flags & B_DIRTY){
+      outb(0x1f7, IDE_CMD_WRDMA);
+      outb(bmbase + BM_CMD, BM_CMD_START);
+    } else {
+      outb(0x1f7, IDE_CMD_RDDMA);
+      outb(bmbase + BM_CMD, BM_CMD_START | BM_CMD_READ);
+    }
+    dmaactive = 1;
+    return;
+  }
   if(b->flags & B_DIRTY){
     outb(0x1f7, write_cmd);
     outsl(0x1f0, b->data, BSIZE/4);
@@ -104,6 +229,7 @@ void
 ideintr(void)
 {
   struct buf *b;
+  int st;
 
   // First queued buffer is the active request.
   acquire(&idelock);
@@ -112,19 +238,42 @@ ideintr(void)
     release(&idelock);
     return;
   }
-  idequeue = b->qnext;
 
-  // Read data if needed.
-  if(!(b->flags & B_DIRTY) && idewait(1) >= 0)
+  if(dmaactive){
+    st = inb(bmbase + BM_STATUS);
+    if((st & (BM_STATUS_ERR | BM_STATUS_INTR)) == 0){
+      // Transfer still running; not our interrupt.
+      release(&idelock);
+      return;
+    }
+    dmaactive = 0;
+    outb(bmbase + BM_CMD, 0);
+    outb(bmbase + BM_STATUS, st | BM_STATUS_ERR | BM_STATUS_INTR);
+    if((st & BM_STATUS_ERR) || idewait(1) < 0){
+      // Give up on DMA and redo the request with PIO.
+      cprintf("ide: dma error, falling back to pio\n");
+      bmbase = 0;
+      idestart(b);
+      release(&idelock);
+      return;
+    }
+  } else if(idewait(1) < 0){
+    cprintf("ide: i/o error on block %d\n", b->blockno);
+    b->flags |= B_ERROR;
+  } else if(!(b->flags & B_DIRTY)){
+    // Read data if needed.
     insl(0x1f0, b->data, BSIZE/4);
+  }
 
   // Wake process waiting for this buf.
-  b->flags |= B_VALID;
+  ioscheddone(b);
+  if(!(b->flags & B_ERROR))
+    b->flags |= B_VALID;
   b->flags &= ~B_DIRTY;
   wakeup(b);
 
   // Start disk on next buf in queue.
-  if(idequeue != 0)
+  if((idequeue = ioschednext()) != 0)
     idestart(idequeue);
 
   release(&idelock);
@@ -134,11 +283,10 @@ ideintr(void)
 // Sync buf with disk.
 // If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
 // Else if B_VALID is not set, read buf from disk, set B_VALID.
-void
+// Return -1 if the disk failed the request.
+int
 iderw(struct buf *b)
 {
-  struct buf **pp;
-
   if(!holdingsleep(&b->lock))
     panic("iderw: buf not locked");
   if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
@@ -148,21 +296,23 @@ iderw(struct buf *b)
 
   acquire(&idelock);  //DOC:acquire-lock
 
-  // Append b to idequeue.
-  b->qnext = 0;
-  for(pp=&idequeue; *pp; pp=&(*pp)->qnext)  //DOC:insert-queue
-    ;
-  *pp = b;
+  // Queue b for the scheduler.
+  ioschedadd(b);  //DOC:insert-queue
 
   // Start disk if necessary.
-  if(idequeue == b)
-    idestart(b);
+  if(idequeue == 0 && (idequeue = ioschednext()) != 0)
+    idestart(idequeue);
 
   // Wait for request to finish.
-  while((b->flags & (B_VALID|B_DIRTY)) != B_VALID){
+  while((b->flags & (B_VALID|B_DIRTY)) != B_VALID && !(b->flags & B_ERROR)){
     sleep(b, &idelock);
   }
 
 
   release(&idelock);
+  if(b->flags & B_ERROR){
+    b->flags &= ~B_ERROR;
+    return -1;
+  }
+  return 0;
 }
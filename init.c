@@ -19,6 +19,11 @@ main(void)
   dup(0);  // stdout
   dup(0);  // stderr
 
+  // Scratch files go in memory.
+  mkdir("tmp");
+  if(mount("tmp") < 0)
+    printf(1, "init: cannot mount /tmp\n");
+
   for(;;){
     printf(1, "init: starting sh\n");
     pid = fork();
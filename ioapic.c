@@ -66,10 +66,28 @@ ioapicinit(void)
 
 void
 ioapicenable(int irq, int cpunum)
+{
+  ioapicroute(irq, T_IRQ0 + irq, cpunum);
+}
+
+// Like ioapicenable, but deliver irq as interrupt vector vec
+// instead of T_IRQ0 + irq.
+void
+ioapicroute(int irq, int vec, int cpunum)
 {
   // Mark interrupt edge-triggered, active high,
   // enabled, and routed to the given cpunum,
   // which happens to be that cpu's APIC ID.
-  ioapicwrite(REG_TABLE+2*irq, T_IRQ0 + irq);
+  ioapicwrite(REG_TABLE+2*irq, vec);
+  ioapicwrite(REG_TABLE+2*irq+1, cpunum << 24);
+}
+
+// Like ioapicroute, for a PCI INTx line, which unlike
+// an ISA one is level-triggered and active low, and
+// stays asserted until the device is told to drop it.
+void
+ioapicroutepci(int irq, int vec, int cpunum)
+{
+  ioapicwrite(REG_TABLE+2*irq, vec | INT_LEVEL | INT_ACTIVELOW);
   ioapicwrite(REG_TABLE+2*irq+1, cpunum << 24);
 }
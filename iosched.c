@@ -0,0 +1,409 @@
+// I/O scheduler: decides the order in which queued disk
+// requests are handed to the disk driver.
+//
+// The driver calls ioschedadd() for each new request,
+// ioschednext() whenever the disk can take another one,
+// and ioscheddone() when a request completes.  The driver's
+// lock protects all scheduler state.
+//
+// Policies, chosen by IOSCHED in param.h:
+//   fifo:     arrival order.
+//   clook:    one-way elevator.  Requests at or beyond the
+//             last dispatched block are served in increasing
+//             block order; the rest wait for the next sweep.
+//   deadline: separate elevators for reads and writes, reads
+//             preferred, and any request older than its
+//             deadline served first so that no request starves.
+//
+// Elevators are a pair of binary heaps keyed by block number,
+// so adding and dispatching a request is O(log n).
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "x86.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "buf.h"
+
+#define READ  0
+#define WRITE 1
+
+// Deadlines, in ticks, and how many times reads may be
+// chosen over waiting writes in a row.
+#define READEXPIRE    50
+#define WRITEEXPIRE  500
+#define WRITESTARVE    2
+
+#define NHIST 16   // latency histogram buckets
+
+// Requests that can be queued at once: every buffer
+// in the cache, plus the one log.c writes through.
+#define NQUEUE (NBUF+1)
+
+// A min-heap of requests ordered by disk position.
+struct heap {
+  struct buf *b[NQUEUE];
+  int n;
+};
+
+// A C-LOOK elevator.  ahead holds requests at or beyond
+// pos; behind holds those the head has already passed.
+struct elevator {
+  struct heap h[2];
+  struct heap *ahead;
+  struct heap *behind;
+  uint pos;
+};
+
+// Requests in arrival order, through qnext/qprev.
+struct fifo {
+  struct buf *head;
+  struct buf *tail;
+};
+
+struct iostat {
+  uint n;           // completed requests
+  uint lat;         // sum of latencies, in units of 1024 cycles
+  uint maxlat;
+  uint seek;        // sum of block distances moved
+  uint hist[NHIST]; // hist[i] counts latencies < 2^i * 1024 cycles
+};
+
+struct iosched {
+  char *name;
+  void (*add)(struct buf*);
+  struct buf *(*next)(void);
+};
+
+static struct {
+  struct iosched *policy;
+  struct fifo fifo[2];      // per direction; fifo[READ] only, for fifo
+  struct elevator elev[2];  // per direction; elev[READ] only, for clook
+  int wstarved;             // reads chosen while writes waited
+  uint lastblock;
+  struct iostat stat[2];
+} io;
+
+static int
+dir(struct buf *b)
+{
+  return (b->flags & B_DIRTY) ? WRITE : READ;
+}
+
+// Order by device, then block.
+static int
+before(struct buf *a, struct buf *b)
+{
+  if(a->dev != b->dev)
+    return a->dev < b->dev;
+  return a->blockno < b->blockno;
+}
+
+static void
+heapswap(struct heap *h, int i, int j)
+{
+  struct buf *t;
+
+  t = h->b[i];
+  h->b[i] = h->b[j];
+  h->b[j] = t;
+  h->b[i]->qidx = i;
+  h->b[j]->qidx = j;
+}
+
+static void
+heapup(struct heap *h, int i)
+{
+  while(i > 0 && before(h->b[i], h->b[(i-1)/2])){
+    heapswap(h, i, (i-1)/2);
+    i = (i-1)/2;
+  }
+}
+
+static void
+heapdown(struct heap *h, int i)
+{
+  int c;
+
+  for(;;){
+    c = 2*i + 1;
+    if(c >= h->n)
+      break;
+    if(c+1 < h->n && before(h->b[c+1], h->b[c]))
+      c++;
+    if(!before(h->b[c], h->b[i]))
+      break;
+    heapswap(h, i, c);
+    i = c;
+  }
+}
+
+static void
+heapinsert(struct heap *h, struct buf *b)
+{
+  if(h->n >= NQUEUE)
+    panic("iosched: heap full");
+  b->qidx = h->n;
+  h->b[h->n++] = b;
+  heapup(h, b->qidx);
+}
+
+static void
+heapremove(struct heap *h, struct buf *b)
+{
+  int i;
+
+  i = b->qidx;
+  if(i >= h->n || h->b[i] != b)
+    panic("iosched: heapremove");
+  h->n--;
+  if(i == h->n)
+    return;
+  h->b[i] = h->b[h->n];
+  h->b[i]->qidx = i;
+  heapup(h, i);
+  heapdown(h, h->b[i]->qidx);
+}
+
+static void
+elevinit(struct elevator *e)
+{
+  e->ahead = &e->h[0];
+  e->behind = &e->h[1];
+  e->ahead->n = e->behind->n = 0;
+  e->pos = 0;
+}
+
+static void
+elevadd(struct elevator *e, struct buf *b)
+{
+  if(b->blockno >= e->pos)
+    heapinsert(e->ahead, b);
+  else
+    heapinsert(e->behind, b);
+}
+
+static void
+elevremove(struct elevator *e, struct buf *b)
+{
+  if(b->qidx < e->ahead->n && e->ahead->b[b->qidx] == b)
+    heapremove(e->ahead, b);
+  else
+    heapremove(e->behind, b);
+  e->pos = b->blockno;
+}
+
+// Next request in the sweep, starting a new sweep
+// from the lowest block if the current one is done.
+static struct buf*
+elevpeek(struct elevator *e)
+{
+  struct heap *t;
+
+  if(e->ahead->n == 0){
+    t = e->ahead;
+    e->ahead = e->behind;
+    e->behind = t;
+  }
+  if(e->ahead->n == 0)
+    return 0;
+  return e->ahead->b[0];
+}
+
+static void
+fifoadd(struct fifo *f, struct buf *b)
+{
+  b->qnext = 0;
+  b->qprev = f->tail;
+  if(f->tail)
+    f->tail->qnext = b;
+  else
+    f->head = b;
+  f->tail = b;
+}
+
+static void
+fiforemove(struct fifo *f, struct buf *b)
+{
+  if(b->qprev)
+    b->qprev->qnext = b->qnext;
+  else
+    f->head = b->qnext;
+  if(b->qnext)
+    b->qnext->qprev = b->qprev;
+  else
+    f->tail = b->qprev;
+  b->qnext = b->qprev = 0;
+}
+
+//PAGEBREAK!
+// fifo policy.
+
+static void
+fifoschedadd(struct buf *b)
+{
+  fifoadd(&io.fifo[READ], b);
+}
+
+static struct buf*
+fifoschednext(void)
+{
+  struct buf *b;
+
+  if((b = io.fifo[READ].head) != 0)
+    fiforemove(&io.fifo[READ], b);
+  return b;
+}
+
+// clook policy.
+
+static void
+clookadd(struct buf *b)
+{
+  elevadd(&io.elev[READ], b);
+}
+
+static struct buf*
+clooknext(void)
+{
+  struct buf *b;
+
+  if((b = elevpeek(&io.elev[READ])) != 0)
+    elevremove(&io.elev[READ], b);
+  return b;
+}
+
+// deadline policy.
+
+static void
+deadlineadd(struct buf *b)
+{
+  int d;
+
+  d = dir(b);
+  elevadd(&io.elev[d], b);
+  fifoadd(&io.fifo[d], b);
+}
+
+static struct buf*
+deadlinenext(void)
+{
+  struct buf *b;
+  int d, expire;
+
+  if(io.fifo[READ].head && (io.fifo[WRITE].head == 0 || io.wstarved < WRITESTARVE)){
+    d = READ;
+    if(io.fifo[WRITE].head)
+      io.wstarved++;
+  } else if(io.fifo[WRITE].head){
+    d = WRITE;
+    io.wstarved = 0;
+  } else
+    return 0;
+
+  // Serve the oldest request if it has waited too long,
+  // otherwise continue the sweep.
+  expire = (d == READ) ? READEXPIRE : WRITEEXPIRE;
+  b = io.fifo[d].head;
+  if(ticks - b->qtime < expire)
+    b = elevpeek(&io.elev[d]);
+  elevremove(&io.elev[d], b);
+  fiforemove(&io.fifo[d], b);
+  return b;
+}
+
+static struct iosched policies[] = {
+  { "fifo", fifoschedadd, fifoschednext },
+  { "clook", clookadd, clooknext },
+  { "deadline", deadlineadd, deadlinenext },
+};
+
+//PAGEBREAK!
+void
+ioschedinit(void)
+{
+  struct iosched *p;
+
+  elevinit(&io.elev[READ]);
+  elevinit(&io.elev[WRITE]);
+  for(p = policies; p < &policies[NELEM(policies)]; p++){
+    if(strncmp(p->name, IOSCHED, 16) == 0){
+      io.policy = p;
+      return;
+    }
+  }
+  panic("ioschedinit: unknown IOSCHED");
+}
+
+// Queue b for the disk.
+void
+ioschedadd(struct buf *b)
+{
+  b->qtime = ticks;
+  b->qtsc = rdtsc();
+  io.policy->add(b);
+}
+
+// Remove and return the request the disk should serve next,
+// or 0 if there is none.
+struct buf*
+ioschednext(void)
+{
+  struct buf *b;
+  struct iostat *s;
+
+  if((b = io.policy->next()) == 0)
+    return 0;
+  s = &io.stat[dir(b)];
+  s->seek += (b->blockno > io.lastblock) ? b->blockno - io.lastblock :
+                                           io.lastblock - b->blockno;
+  io.lastblock = b->blockno;
+  return b;
+}
+
+// Account for a finished request.
+// Call before clearing B_DIRTY so that it counts as a write.
+void
+ioscheddone(struct buf *b)
+{
+  struct iostat *s;
+  uint lat;
+  int i;
+
+  s = &io.stat[dir(b)];
+  lat = (rdtsc() - b->qtsc) >> 10;
+  s->n++;
+  s->lat += lat;
+  if(lat > s->maxlat)
+    s->maxlat = lat;
+  for(i = 0; i < NHIST-1 && lat >= (1 << i); i++)
+    ;
+  s->hist[i]++;
+}
+
+// Print request counts and latencies to the console.
+// Latencies are in units of 1024 TSC cycles.
+void
+iostatdump(void)
+{
+  static char *names[] = { "read", "write" };
+  struct iostat *s;
+  int d, i;
+
+  if(io.policy == 0)
+    return;
+  cprintf("iosched %s\n", io.policy->name);
+  for(d = READ; d <= WRITE; d++){
+    s = &io.stat[d];
+    if(s->n == 0)
+      continue;
+    cprintf("%s: %d reqs, avg seek %d, avg lat %d, max lat %d\n",
+            names[d], s->n, s->seek / s->n, s->lat / s->n, s->maxlat);
+    cprintf("  lat <2^i:");
+    for(i = 0; i < NHIST; i++)
+      cprintf(" %d", s->hist[i]);
+    cprintf("\n");
+  }
+}
@@ -1,6 +1,8 @@
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "mmu.h"
+#include "proc.h"
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "fs.h"
@@ -9,18 +11,42 @@
 // Simple logging that allows concurrent FS system calls.
 //
 // A log transaction contains the updates of multiple FS system
-// calls. The logging system only commits when there are
-// no FS system calls active. Thus there is never
+// calls. The logging system only closes a transaction when there
+// are no FS system calls active in it. Thus there is never
 // any reasoning required about whether a commit might
 // write an uncommitted system call's updates to disk.
 //
 // A system call should call begin_op()/end_op() to mark
-// its start and end. Usually begin_op() just increments
-// the count of in-progress FS system calls and returns.
-// But if it thinks the log is close to running out, it
-// sleeps until the last outstanding end_op() commits.
+// its start and end. begin_op() is told what kind of
+// operation follows (OP_CREATE etc. in param.h) and reserves
+// that many log blocks, plus enough to free an inode, since
+// any operation may drop the last reference to one.
+// Usually that just takes the reservation and returns.
+// But if the log is close to running out, it sleeps
+// until the open transaction has been closed.
+//
+// Transactions are pipelined: closing a transaction copies
+// its blocks out of the buffer cache, and from then on new
+// system calls fill the next transaction while the closed
+// one is written to the log and installed.  Commits are
+// serialized, since there is only one log on disk.
+//
+// Group commit: when several processes have joined a
+// transaction, the last end_op() holds it open for up to
+// LOGWINDOW ticks so that more system calls can join before
+// it is written.  A transaction used by a single process
+// commits at once.
+//
+// On a file system made with mkfs -a (FS_ASYNC), end_op()
+// does not commit until the log is nearly full or the open
+// transaction is LOGDELAY ticks old, and a logflush kernel
+// process commits a transaction that has gone idle.  A crash
+// may then lose the last few seconds of system calls, but
+// never leaves the file system inconsistent.  fsync() waits
+// until everything done so far is committed, in either mode.
 //
 // The log is a physical re-do log containing disk blocks.
+// Its size is chosen by mkfs and recorded in the superblock.
 // The on-disk log format:
 //   header block, containing block #s for block A, B, C, ...
 //   block A
@@ -28,10 +54,29 @@
 //   block C
 //   ...
 // Log appends are synchronous.
+//
+// The header carries a checksum of itself and of the logged
+// blocks, so a transaction counts as committed only if the
+// header and all its blocks reached the disk.  Recovery
+// replays the last committed transaction, which is harmless
+// if it was already installed.  So the header is written once
+// per commit: there is no need to erase it after installing,
+// because the next commit's log writes make the old header's
+// checksum fail until its own header is written.
+//
+// Ordered data: writeibulk() may write a data block straight
+// to its home location instead of logging it, as long as the
+// block lies past the end of its file (so nothing committed
+// reads it) and log_ordered() agrees that no transaction that
+// could still be replayed or rolled back involves it.  The
+// write is synchronous, so the data is on disk before the
+// transaction that makes it part of the file commits.
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
 struct logheader {
+  uint seq;   // commit number
+  uint crc;   // crc32 of seq, n, block[] and the logged blocks
   int n;
   int block[LOGSIZE];
 };
@@ -39,16 +84,70 @@ struct logheader {
 struct log {
   struct spinlock lock;
   int start;
-  int size;
+  int size;        // data blocks in the log, not counting the header
+  int freecost;    // log blocks written by freeing or trimming an inode
   int outstanding; // how many FS sys calls are executing.
-  int committing;  // in commit(), please wait.
+  int reserved;    // log blocks reserved by them.
+  int committing;  // in commit(), writing a closed transaction.
+  int closing;     // commit() is copying out lh, please wait.
+  int waiting;     // an end_op() is holding lh open for more ops.
+  int nops;        // FS sys calls that have joined lh.
+  int freed;       // lh frees disk blocks.
+  int cfreed;      // clh frees disk blocks, and is not yet committed.
+  int async;       // FS_ASYNC: commit on a timer, not at end_op().
+  int syncing;     // log_sync() calls waiting for a commit.
+  uint durable;    // seq of the last transaction committed to disk.
+  uint opened;     // ticks when the first of them joined.
   int dev;
-  struct logheader lh;
+  struct logheader lh;   // the open transaction
+  struct logheader clh;  // the transaction being committed
+  char *data[LOGSIZE];   // clh's blocks, as of when it closed
+  struct buf buf;        // for writing copies, bypassing the cache
 };
 struct log log;
 
+static uint crctab[256];
+
 static void recover_from_log(void);
-static void commit();
+static void commit(void);
+static void logflush(void);
+
+static void
+crcinit(void)
+{
+  uint c;
+  int i, j;
+
+  for (i = 0; i < 256; i++) {
+    c = i;
+    for (j = 0; j < 8; j++)
+      c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+    crctab[i] = c;
+  }
+}
+
+// Continue a CRC-32 computation over n bytes at p.
+static uint
+crc32(uint crc, void *p, int n)
+{
+  uchar *s = p;
+
+  crc = ~crc;
+  while (n-- > 0)
+    crc = crctab[(crc ^ *s++) & 0xFF] ^ (crc >> 8);
+  return ~crc;
+}
+
+// Checksum of lh, apart from lh->crc itself.
+static uint
+headcrc(struct logheader *lh)
+{
+  uint crc;
+
+  crc = crc32(0, &lh->seq, sizeof(lh->seq));
+  crc = crc32(crc, &lh->n, sizeof(lh->n));
+  return crc32(crc, lh->block, lh->n * sizeof(lh->block[0]));
+}
 
 void
 initlog(int dev)
@@ -57,26 +156,99 @@ initlog(int dev)
     panic("initlog: too big logheader");
 
   struct superblock sb;
+  char *p;
+  int i;
+
   initlock(&log.lock, "log");
+  initsleeplock(&log.buf.lock, "logbuf");
+  crcinit();
   readsb(dev, &sb);
   log.start = sb.logstart;
-  log.size = sb.nlog;
+  log.size = sb.nlog - 1;
+  // Logged blocks stay in the buffer cache until installed,
+  // so NBUF only has room for LOGSIZE.  mkfs makes no bigger
+  // log; an image from elsewhere uses part of its log.
+  if (log.size > LOGSIZE)
+    log.size = LOGSIZE;
+  log.freecost = 1 + sb.size/BPB + 1 + 1;  // inode, bitmap, extent block
+  if (log.size < MAXOPBLOCKS + log.freecost)
+    panic("initlog: log too small");
   log.dev = dev;
+  log.async = (sb.features & FS_ASYNC) != 0;
+  p = 0;
+  for (i = 0; i < log.size; i++) {
+    if (i % (PGSIZE/BSIZE) == 0 && (p = kalloc()) == 0)
+      panic("initlog: out of memory");
+    log.data[i] = p + (i % (PGSIZE/BSIZE)) * BSIZE;
+  }
   recover_from_log();
+  if (log.async)
+    kproc("logflush", logflush);
 }
 
-// Copy committed blocks from log to their home location
+// Write data to block blockno without going through the
+// buffer cache, whose copy may already hold newer changes.
 static void
-install_trans(void)
+write_copy(uint blockno, char *data)
 {
-  int tail;
+  struct buf *b = &log.buf;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
-    brelse(lbuf);
+  acquiresleep(&b->lock);
+  b->dev = log.dev;
+  b->blockno = blockno;
+  memmove(b->data, data, BSIZE);
+  b->flags = B_DIRTY;
+  // A commit that cannot reach the disk intact cannot
+  // keep the file system consistent.
+  if(iderw(b) < 0)
+    panic("log: i/o error");
+  releasesleep(&b->lock);
+}
+
+// Is blockno part of the transaction described by lh?
+// Caller must hold log.lock.
+static int
+logged(struct logheader *lh, int blockno)
+{
+  int i;
+
+  for (i = 0; i < lh->n; i++) {
+    if (lh->block[i] == blockno)
+      return 1;
+  }
+  return 0;
+}
+
+// Copy committed blocks to their home location.
+// During recovery they come from the on-disk log, otherwise
+// from the copies taken when the transaction closed.
+static void
+install_trans(int recovering)
+{
+  int tail, relogged;
+
+  for (tail = 0; tail < log.clh.n; tail++) {
+    if (recovering) {
+      struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
+      struct buf *dbuf = bread(log.dev, log.clh.block[tail]); // read dst
+      memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
+      bwrite(dbuf);  // write dst to disk
+      brelse(lbuf);
+      brelse(dbuf);
+      continue;
+    }
+    // The cached block is still pinned by B_DIRTY. Unless the
+    // open transaction has changed it since, it matches the
+    // copy, and writing it out unpins it. Holding the buffer
+    // keeps log_write() away while we decide.
+    struct buf *dbuf = bread(log.dev, log.clh.block[tail]);
+    acquire(&log.lock);
+    relogged = logged(&log.lh, dbuf->blockno);
+    release(&log.lock);
+    if (relogged)
+      write_copy(dbuf->blockno, log.data[tail]);
+    else
+      bwrite(dbuf);
     brelse(dbuf);
   }
 }
@@ -88,14 +260,18 @@ read_head(void)
   struct buf *buf = bread(log.dev, log.start);
   struct logheader *lh = (struct logheader *) (buf->data);
   int i;
-  log.lh.n = lh->n;
-  for (i = 0; i < log.lh.n; i++) {
-    log.lh.block[i] = lh->block[i];
+  log.clh.seq = lh->seq;
+  log.clh.crc = lh->crc;
+  log.clh.n = lh->n;
+  if (log.clh.n < 0 || log.clh.n > log.size)
+    log.clh.n = 0;
+  for (i = 0; i < log.clh.n; i++) {
+    log.clh.block[i] = lh->block[i];
   }
   brelse(buf);
 }
 
-// Write in-memory log header to disk.
+// Write the committing transaction's header to disk.
 // This is the true point at which the
 // current transaction commits.
 static void
@@ -104,36 +280,82 @@ write_head(void)
   struct buf *buf = bread(log.dev, log.start);
   struct logheader *hb = (struct logheader *) (buf->data);
   int i;
-  hb->n = log.lh.n;
-  for (i = 0; i < log.lh.n; i++) {
-    hb->block[i] = log.lh.block[i];
+  hb->seq = log.clh.seq;
+  hb->crc = log.clh.crc;
+  hb->n = log.clh.n;
+  for (i = 0; i < log.clh.n; i++) {
+    hb->block[i] = log.clh.block[i];
   }
   bwrite(buf);
   brelse(buf);
 }
 
+// Does the on-disk log hold the transaction in log.clh,
+// complete?
+static int
+committed(void)
+{
+  struct buf *b;
+  uint crc;
+  int i;
+
+  crc = headcrc(&log.clh);
+  for (i = 0; i < log.clh.n; i++) {
+    b = bread(log.dev, log.start+i+1);
+    crc = crc32(crc, b->data, BSIZE);
+    brelse(b);
+  }
+  return crc == log.clh.crc;
+}
+
 static void
 recover_from_log(void)
 {
   read_head();
-  install_trans(); // if committed, copy from log to disk
-  log.lh.n = 0;
-  write_head(); // clear the log
+  // A committed transaction stays in clh: it is replayed
+  // again after another crash, until the next commit.
+  if (committed())
+    install_trans(1); // copy from log to disk
+  else
+    log.clh.n = 0;
+  log.lh.seq = log.clh.seq + 1;
+  log.durable = log.clh.seq;
+}
+
+// In async mode, should the open transaction commit as
+// soon as no FS sys calls are using it?  Caller must hold
+// log.lock.
+static int
+commitdue(void)
+{
+  return log.syncing > 0 || ticks - log.opened >= LOGDELAY ||
+         log.lh.n + MAXOPBLOCKS + log.freecost > log.size;
 }
 
 // called at the start of each FS system call.
+// op is the most log blocks the call will write,
+// not counting freeing an inode.
 void
-begin_op(void)
+begin_op(int op)
 {
+  int n;
+
+  n = op + log.freecost;
   acquire(&log.lock);
   while(1){
-    if(log.committing){
+    if(log.closing){
       sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
+    } else if(log.lh.n + log.reserved + n > log.size){
       // this op might exhaust log space; wait for commit.
+      if(log.waiting)
+        wakeup(&ticks);  // no point holding the transaction open
       sleep(&log, &log.lock);
     } else {
+      if(log.nops++ == 0)
+        log.opened = ticks;
       log.outstanding += 1;
+      log.reserved += n;
+      myproc()->logres = n;
       release(&log.lock);
       break;
     }
@@ -141,69 +363,110 @@ begin_op(void)
 }
 
 // called at the end of each FS system call.
-// commits if this was the last outstanding operation.
+// commits if this was the last outstanding operation,
+// unless a commit is already in progress, in which case
+// that committer picks up this transaction when it is done.
 void
 end_op(void)
 {
-  int do_commit = 0;
-
   acquire(&log.lock);
   log.outstanding -= 1;
-  if(log.committing)
-    panic("log.committing");
-  if(log.outstanding == 0){
-    do_commit = 1;
-    log.committing = 1;
-  } else {
-    // begin_op() may be waiting for log space,
-    // and decrementing log.outstanding has decreased
-    // the amount of reserved space.
-    wakeup(&log);
+  log.reserved -= myproc()->logres;
+  // begin_op() may be waiting for log space,
+  // and this op's reservation is no longer needed.
+  wakeup(&log);
+  if(log.outstanding > 0 || log.waiting || log.committing ||
+     (log.async && !commitdue())){
+    release(&log.lock);
+    return;
   }
-  release(&log.lock);
 
-  if(do_commit){
-    // call commit w/o holding locks, since not allowed
-    // to sleep with locks.
+  // Group commit: if other processes are using this
+  // transaction, give them a moment to join it.
+  log.waiting = 1;
+  while(log.outstanding == 0 && log.nops > 1 && log.lh.n > 0 &&
+        log.lh.n + MAXOPBLOCKS <= log.size && ticks - log.opened < LOGWINDOW)
+    sleep(&ticks, &log.lock);
+  log.waiting = 0;
+
+  // If an op joined, the last of them to finish commits.
+  // Otherwise commit, and keep going as long as the next
+  // transaction has finished by the time this one is done.
+  while(log.outstanding == 0 && !log.committing){
+    if(log.lh.n == 0){
+      log.nops = 0;
+      break;
+    }
+    if(log.async && !commitdue())
+      break;
     commit();
-    acquire(&log.lock);
-    log.committing = 0;
-    wakeup(&log);
-    release(&log.lock);
   }
+  release(&log.lock);
 }
 
-// Copy modified blocks from cache to log.
+// Copy the committing transaction's blocks to the log,
+// and seal its header with their checksum.
 static void
 write_log(void)
 {
+  uint crc;
   int tail;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
-    brelse(from);
-    brelse(to);
+  crc = headcrc(&log.clh);
+  for (tail = 0; tail < log.clh.n; tail++) {
+    write_copy(log.start+tail+1, log.data[tail]);
+    crc = crc32(crc, log.data[tail], BSIZE);
   }
+  log.clh.crc = crc;
 }
 
+// Close the open transaction and commit it.
+// Called with log.lock held and no FS sys calls outstanding,
+// but releases it while doing disk I/O, so that new FS sys
+// calls can start the next transaction in the meantime.
 static void
-commit()
-{
-  if (log.lh.n > 0) {
-    write_log();     // Write modified blocks from cache to log
-    write_head();    // Write header to disk -- the real commit
-    install_trans(); // Now install writes to home locations
-    log.lh.n = 0;
-    write_head();    // Erase the transaction from the log
+commit(void)
+{
+  struct buf *b;
+  int i;
+
+  log.committing = 1;
+  log.closing = 1;
+  log.clh = log.lh;
+  log.cfreed = log.freed;
+  log.lh.seq++;
+  log.lh.n = 0;
+  log.nops = 0;
+  log.freed = 0;
+  release(&log.lock);
+
+  // Take copies of the blocks before the next
+  // transaction can change them in the cache.
+  for (i = 0; i < log.clh.n; i++) {
+    b = bread(log.dev, log.clh.block[i]);
+    memmove(log.data[i], b->data, BSIZE);
+    brelse(b);
   }
+  acquire(&log.lock);
+  log.closing = 0;
+  wakeup(&log);
+  release(&log.lock);
+
+  write_log();      // Write modified blocks to log
+  write_head();     // Write header to disk -- the real commit
+  install_trans(0); // Now install writes to home locations
+
+  acquire(&log.lock);
+  log.committing = 0;
+  log.cfreed = 0;
+  log.durable = log.clh.seq;
+  wakeup(&log);
 }
 
 // Caller has modified b->data and is done with the buffer.
 // Record the block number and pin in the cache with B_DIRTY.
-// commit()/write_log() will do the disk write.
+// commit() will do the disk write, and install_trans()
+// unpins the block once it is at its home location.
 //
 // log_write() replaces bwrite(); a typical use is:
 //   bp = bread(...)
@@ -215,7 +478,7 @@ log_write(struct buf *b)
 {
   int i;
 
-  if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1)
+  if (log.lh.n >= log.size)
     panic("too big a transaction");
   if (log.outstanding < 1)
     panic("log_write outside of trans");
@@ -232,3 +495,85 @@ log_write(struct buf *b)
   release(&log.lock);
 }
 
+// Wait until every FS system call that has finished, and
+// any still running, is committed to disk.  Must not be
+// called inside a transaction.
+void
+log_sync(void)
+{
+  uint seq;
+
+  acquire(&log.lock);
+  if(log.lh.n > 0)
+    seq = log.lh.seq;
+  else if(log.committing)
+    seq = log.clh.seq;
+  else
+    seq = log.durable;
+  log.syncing++;
+  while((int)(log.durable - seq) < 0){
+    if(log.outstanding == 0 && !log.committing && log.lh.n > 0)
+      commit();
+    else
+      sleep(&log, &log.lock);
+  }
+  log.syncing--;
+  release(&log.lock);
+}
+
+// The logflush process: in async mode, commit the open
+// transaction once it is due and no sys call is using it.
+static void
+logflush(void)
+{
+  acquire(&log.lock);
+  for(;;){
+    if(log.outstanding == 0 && !log.committing && log.lh.n > 0 && commitdue())
+      commit();
+    else
+      sleep(&ticks, &log.lock);
+  }
+}
+
+// Note that the calling op has freed disk blocks.
+void
+log_freed(void)
+{
+  acquire(&log.lock);
+  log.freed = 1;
+  release(&log.lock);
+}
+
+// May the calling op write b, a block past the end of its
+// file, straight to disk instead of through the log?  Not if
+// the open or the last committed transaction logs it, since
+// installing or replaying that would overwrite the data.  Nor
+// if a transaction that has not committed frees blocks: b may
+// be one of them, and a crash would give it back to its old
+// owner with the new data in it.
+int
+log_ordered(struct buf *b)
+{
+  int ok;
+
+  acquire(&log.lock);
+  ok = !log.freed && !log.cfreed &&
+       !logged(&log.lh, b->blockno) && !logged(&log.clh, b->blockno);
+  release(&log.lock);
+  return ok;
+}
+
+// How many more blocks the calling op may log_write(), even
+// past its own reservation, without taking log space that
+// other ops have reserved, and keeping back enough to free
+// an inode.
+int
+log_room(void)
+{
+  int n;
+
+  acquire(&log.lock);
+  n = log.size - log.lh.n - (log.reserved - myproc()->logres) - log.freecost;
+  release(&log.lock);
+  return n;
+}
@@ -4,6 +4,7 @@
 #include <string.h>
 #include <fcntl.h>
 #include <assert.h>
+#include <sys/mman.h>
 
 #define stat xv6_stat  // avoid clash with host struct stat
 #include "types.h"
@@ -16,30 +17,41 @@
 #endif
 
 #define NINODES 200
+#define IOSIZE (1<<20)  // bytes read from input files at once
 
 // Disk layout:
 // [ boot block | sb block | log | inode blocks | free bit map | data blocks ]
 
-int nbitmap = FSSIZE/(BSIZE*8) + 1;
-int ninodeblocks = NINODES / IPB + 1;
-int nlog = LOGSIZE;
+uint fssize = FSSIZE;  // blocks; set with -s
+uint ninodes = NINODES; // set with -i
+int nbitmap;
+int ninodeblocks;
+int nlog = LOGSIZE+1;  // header and data blocks; set with -l
+int extents = 1;       // extents and inline data; -b turns off
+int async;             // FS_ASYNC; -a turns on
 int nmeta;    // Number of meta blocks (boot, sb, nlog, inode, bitmap)
 int nblocks;  // Number of data blocks
 
 int fsfd;
+uchar *img;   // the image, mapped into memory
 struct superblock sb;
-char zeroes[BSIZE];
 uint freeinode = 1;
 uint freeblock;
+struct dirent *rootdir;  // root directory entries
+int nrootdir;
 
 
-void balloc(int);
+void balloc(uint);
+uint getsize(char*);
+void toosmall(void);
 void wsect(uint, void*);
 void winode(uint, struct dinode*);
 void rinode(uint inum, struct dinode *ip);
 void rsect(uint sec, void *buf);
 uint ialloc(ushort type);
 void iappend(uint inum, void *p, int n);
+void iinline(uint inum, void *p, int n);
+void dirwrite(uint inum, struct dirent *de, int n);
 
 // convert to intel byte order
 ushort
@@ -68,64 +80,122 @@ int
 main(int argc, char *argv[])
 {
   int i, cc, fd;
-  uint rootino, inum, off;
-  struct dirent de;
-  char buf[BSIZE];
-  struct dinode din;
+  uint rootino, inum;
+  struct dirent *de;
+  char *buf;
 
 
   static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
 
-  if(argc < 2){
-    fprintf(stderr, "Usage: mkfs fs.img files...\n");
+  for(;;){
+    if(argc >= 3 && strcmp(argv[1], "-l") == 0){
+      nlog = atoi(argv[2]);
+      argc -= 2;
+      argv += 2;
+    } else if(argc >= 3 && strcmp(argv[1], "-s") == 0){
+      fssize = getsize(argv[2]);
+      argc -= 2;
+      argv += 2;
+    } else if(argc >= 3 && strcmp(argv[1], "-i") == 0){
+      ninodes = atoi(argv[2]);
+      argc -= 2;
+      argv += 2;
+    } else if(argc >= 2 && strcmp(argv[1], "-b") == 0){
+      extents = 0;
+      argc--;
+      argv++;
+    } else if(argc >= 2 && strcmp(argv[1], "-a") == 0){
+      async = 1;
+      argc--;
+      argv++;
+    } else
+      break;
+  }
+  if(argc < 2 || nlog < 2 || ninodes < 2){
+    fprintf(stderr, "Usage: mkfs [-a] [-b] [-s size[k|m|g]] [-i ninodes] [-l nlog] fs.img files...\n");
+    exit(1);
+  }
+  nbitmap = fssize/(BSIZE*8) + 1;
+  ninodeblocks = ninodes / IPB + 1;
+  if(ninodes > 0xFFFF){
+    fprintf(stderr, "mkfs: at most %d inodes\n", 0xFFFF);  // dirent inum is a ushort
+    exit(1);
+  }
+  if(nbitmap > NGROUP){
+    fprintf(stderr, "mkfs: at most %d blocks\n", NGROUP*BPB - 1);
+    exit(1);
+  }
+  // The kernel keeps every logged block in its buffer cache
+  // until it is installed, so it uses at most LOGSIZE data
+  // blocks of the log; and it needs room for one operation
+  // and for freeing an inode (see initlog()).
+  if(nlog - 1 > LOGSIZE || nlog - 1 < MAXOPBLOCKS + (int)(fssize/BPB) + 3){
+    fprintf(stderr, "mkfs: -l must be from %d to %d blocks\n",
+            MAXOPBLOCKS + fssize/BPB + 4, LOGSIZE + 1);
     exit(1);
   }
 
+  assert((BSIZE % 512) == 0);  // whole disk sectors
   assert((BSIZE % sizeof(struct dinode)) == 0);
   assert((BSIZE % sizeof(struct dirent)) == 0);
 
+  nmeta = 2 + nlog + ninodeblocks + nbitmap;
+  nblocks = fssize - nmeta;
+  if(nmeta >= fssize){
+    fprintf(stderr, "mkfs: %u blocks leave no room for data\n", fssize);
+    exit(1);
+  }
+
+  // Build the image in a sparse file mapped into memory,
+  // so only blocks that are written take any work.
   fsfd = open(argv[1], O_RDWR|O_CREAT|O_TRUNC, 0666);
   if(fsfd < 0){
     perror(argv[1]);
     exit(1);
   }
+  if(ftruncate(fsfd, (off_t)fssize * BSIZE) < 0){
+    perror("ftruncate");
+    exit(1);
+  }
+  img = mmap(0, (size_t)fssize * BSIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fsfd, 0);
+  if(img == MAP_FAILED){
+    perror("mmap");
+    exit(1);
+  }
+  if((buf = malloc(IOSIZE)) == 0 || (rootdir = calloc(ninodes, sizeof(*rootdir))) == 0){
+    perror("malloc");
+    exit(1);
+  }
 
-  // 1 fs block = 1 disk sector
-  nmeta = 2 + nlog + ninodeblocks + nbitmap;
-  nblocks = FSSIZE - nmeta;
-
-  sb.size = xint(FSSIZE);
+  sb.size = xint(fssize);
   sb.nblocks = xint(nblocks);
-  sb.ninodes = xint(NINODES);
+  sb.ninodes = xint(ninodes);
   sb.nlog = xint(nlog);
   sb.logstart = xint(2);
   sb.inodestart = xint(2+nlog);
   sb.bmapstart = xint(2+nlog+ninodeblocks);
+  sb.bsize = xint(BSIZE);
+  sb.features = xint((extents ? FS_EXTENTS|FS_INLINE : 0) | (async ? FS_ASYNC : 0));
 
-  printf("nmeta %d (boot, super, log blocks %u inode blocks %u, bitmap blocks %u) blocks %d total %d\n",
-         nmeta, nlog, ninodeblocks, nbitmap, nblocks, FSSIZE);
+  printf("nmeta %d (boot, super, log blocks %u inode blocks %u, bitmap blocks %u) blocks %d total %d of %d bytes\n",
+         nmeta, nlog, ninodeblocks, nbitmap, nblocks, fssize, BSIZE);
 
   freeblock = nmeta;     // the first free block that we can allocate
 
-  for(i = 0; i < FSSIZE; i++)
-    wsect(i, zeroes);
-
-  memset(buf, 0, sizeof(buf));
+  memset(buf, 0, BSIZE);
   memmove(buf, &sb, sizeof(sb));
   wsect(1, buf);
 
   rootino = ialloc(T_DIR);
   assert(rootino == ROOTINO);
 
-  bzero(&de, sizeof(de));
-  de.inum = xshort(rootino);
-  strcpy(de.name, ".");
-  iappend(rootino, &de, sizeof(de));
+  de = &rootdir[nrootdir++];
+  de->inum = xshort(rootino);
+  strcpy(de->name, ".");
 
-  bzero(&de, sizeof(de));
-  de.inum = xshort(rootino);
-  strcpy(de.name, "..");
-  iappend(rootino, &de, sizeof(de));
+  de = &rootdir[nrootdir++];
+  de->inum = xshort(rootino);
+  strcpy(de->name, "..");
 
   for(i = 2; i < argc; i++){
     assert(index(argv[i], '/') == 0);
@@ -144,40 +214,68 @@ main(int argc, char *argv[])
 
     inum = ialloc(T_FILE);
 
-    bzero(&de, sizeof(de));
-    de.inum = xshort(inum);
-    strncpy(de.name, argv[i], DIRSIZ);
-    iappend(rootino, &de, sizeof(de));
-
-    while((cc = read(fd, buf, sizeof(buf))) > 0)
-      iappend(inum, buf, cc);
+    assert(nrootdir < ninodes);
+    de = &rootdir[nrootdir++];
+    de->inum = xshort(inum);
+    strncpy(de->name, argv[i], DIRSIZ);
+
+    cc = read(fd, buf, IOSIZE);
+    if(extents && cc >= 0 && cc <= NINLINE && read(fd, buf + cc, 1) == 0)
+      iinline(inum, buf, cc);
+    else {
+      lseek(fd, 0, 0);
+      while((cc = read(fd, buf, IOSIZE)) > 0)
+        iappend(inum, buf, cc);
+    }
 
     close(fd);
   }
 
-  // fix size of root inode dir
-  rinode(rootino, &din);
-  off = xint(din.size);
-  off = ((off/BSIZE) + 1) * BSIZE;
-  din.size = xint(off);
-  winode(rootino, &din);
+  dirwrite(rootino, rootdir, nrootdir);
 
   balloc(freeblock);
 
+  if(munmap(img, (size_t)fssize * BSIZE) < 0 || close(fsfd) < 0){
+    perror(argv[1]);
+    exit(1);
+  }
   exit(0);
 }
 
-void
-wsect(uint sec, void *buf)
+// Parse a size: a number of blocks, or of bytes
+// if followed by k, m or g.
+uint
+getsize(char *s)
 {
-  if(lseek(fsfd, sec * BSIZE, 0) != sec * BSIZE){
-    perror("lseek");
-    exit(1);
-  }
-  if(write(fsfd, buf, BSIZE) != BSIZE){
-    perror("write");
+  unsigned long long n;
+  char *end;
+
+  n = strtoull(s, &end, 0);
+  switch(*end){
+  case 'k': case 'K': n <<= 10; break;
+  case 'm': case 'M': n <<= 20; break;
+  case 'g': case 'G': n <<= 30; break;
+  case 0: return n;
+  default:
+    fprintf(stderr, "mkfs: bad size %s\n", s);
     exit(1);
   }
+  return n / BSIZE;
+}
+
+void
+toosmall(void)
+{
+  fprintf(stderr, "mkfs: image too small for the files; use a larger -s than %u blocks\n", fssize);
+  exit(1);
+}
+
+void
+wsect(uint sec, void *buf)
+{
+  if(sec >= fssize)
+    toosmall();
+  memmove(img + (size_t)sec * BSIZE, buf, BSIZE);
 }
 
 void
@@ -210,14 +308,9 @@ rinode(uint inum, struct dinode *ip)
 void
 rsect(uint sec, void *buf)
 {
-  if(lseek(fsfd, sec * BSIZE, 0) != sec * BSIZE){
-    perror("lseek");
-    exit(1);
-  }
-  if(read(fsfd, buf, BSIZE) != BSIZE){
-    perror("read");
-    exit(1);
-  }
+  if(sec >= fssize)
+    toosmall();
+  memmove(buf, img + (size_t)sec * BSIZE, BSIZE);
 }
 
 uint
@@ -228,6 +321,8 @@ ialloc(ushort type)
 
   bzero(&din, sizeof(din));
   din.type = xshort(type);
+  if(extents)
+    din.flags = xshort(I_EXTENT);
   din.nlink = xshort(1);
   din.size = xint(0);
   winode(inum, &din);
@@ -235,54 +330,113 @@ ialloc(ushort type)
 }
 
 void
-balloc(int used)
+balloc(uint used)
 {
   uchar buf[BSIZE];
-  int i;
+  uint b, i;
 
   printf("balloc: first %d blocks have been allocated\n", used);
-  assert(used < BSIZE*8);
-  bzero(buf, BSIZE);
-  for(i = 0; i < used; i++){
-    buf[i/8] = buf[i/8] | (0x1 << (i%8));
+  assert(used <= fssize);
+  for(b = 0; b < nbitmap; b++){
+    bzero(buf, BSIZE);
+    for(i = 0; i < BPB && b*BPB + i < used; i++)
+      buf[i/8] = buf[i/8] | (0x1 << (i%8));
+    wsect(sb.bmapstart + b, buf);
   }
-  printf("balloc: write bitmap block at sector %d\n", sb.bmapstart);
-  wsect(sb.bmapstart, buf);
+  printf("balloc: wrote %d bitmap blocks at sector %d\n", nbitmap, sb.bmapstart);
 }
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 
+// Return the disk block holding block fbn of an extent-mapped
+// file, allocating it if needed.  Blocks are allocated in
+// order, so files made here have one extent unless another
+// file grew in between; mkfs never needs an extent block.
+uint
+emap(struct dinode *din, uint fbn)
+{
+  struct extent *e;
+  int i;
+
+  e = (struct extent*)din->addrs;
+  for(i = 0; i < NEXTENT && e[i].len != 0; i++){
+    if(fbn - xint(e[i].lblk) < xint(e[i].len))
+      return xint(e[i].pblk) + fbn - xint(e[i].lblk);
+  }
+  if(i > 0 && xint(e[i-1].pblk) + xint(e[i-1].len) == freeblock){
+    e[i-1].len = xint(xint(e[i-1].len) + 1);
+    return freeblock++;
+  }
+  assert(i < NEXTENT);
+  e[i].lblk = xint(fbn);
+  e[i].pblk = xint(freeblock);
+  e[i].len = xint(1);
+  return freeblock++;
+}
+
+// Return entry i of indirect block addr,
+// allocating a block for it if it is empty.
+uint
+indirect(uint addr, uint i)
+{
+  uint a[NINDIRECT];
+
+  rsect(addr, (char*)a);
+  if(a[i] == 0){
+    a[i] = xint(freeblock++);
+    wsect(addr, (char*)a);
+  }
+  return xint(a[i]);
+}
+
 void
 iappend(uint inum, void *xp, int n)
 {
   char *p = (char*)xp;
-  uint fbn, off, n1;
+  uint fbn, off, n1, bn, base, span, i;
   struct dinode din;
   char buf[BSIZE];
-  uint indirect[NINDIRECT];
   uint x;
+  int level;
 
   rinode(inum, &din);
   off = xint(din.size);
   // printf("append inum %d at off %d sz %d\n", inum, off, n);
   while(n > 0){
     fbn = off / BSIZE;
-    assert(fbn < MAXFILE);
-    if(fbn < NDIRECT){
+    if(xshort(din.flags) & I_EXTENT){
+      x = emap(&din, fbn);
+    } else if(fbn < NDIRECT){
       if(xint(din.addrs[fbn]) == 0){
         din.addrs[fbn] = xint(freeblock++);
       }
       x = xint(din.addrs[fbn]);
     } else {
-      if(xint(din.addrs[NDIRECT]) == 0){
-        din.addrs[NDIRECT] = xint(freeblock++);
+      // Find the singly, doubly or triply indirect tree
+      // that maps fbn, as bmap() in fs.c does, and walk
+      // down it.
+      bn = fbn - NDIRECT;
+      base = 0;
+      span = 1;
+      for(level = 0; level < 3; level++){
+        span *= NINDIRECT;
+        if(bn - base < span)
+          break;
+        base += span;
+      }
+      if(level == 3){
+        fprintf(stderr, "mkfs: file too big\n");
+        exit(1);
       }
-      rsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      if(indirect[fbn - NDIRECT] == 0){
-        indirect[fbn - NDIRECT] = xint(freeblock++);
-        wsect(xint(din.addrs[NDIRECT]), (char*)indirect);
+      if(xint(din.addrs[NDIRECT+level]) == 0)
+        din.addrs[NDIRECT+level] = xint(freeblock++);
+      x = xint(din.addrs[NDIRECT+level]);
+      i = bn - base;
+      while(span > 1){
+        span /= NINDIRECT;
+        x = indirect(x, i / span);
+        i %= span;
       }
-      x = xint(indirect[fbn-NDIRECT]);
     }
     n1 = min(n, (fbn + 1) * BSIZE - off);
     rsect(x, buf);
@@ -295,3 +449,85 @@ iappend(uint inum, void *xp, int n)
   din.size = xint(off);
   winode(inum, &din);
 }
+
+// Store the n bytes at p as the whole content of inum,
+// in the inode itself.
+void
+iinline(uint inum, void *p, int n)
+{
+  struct dinode din;
+
+  assert(n <= NINLINE);
+  rinode(inum, &din);
+  din.flags = xshort(I_INLINE);
+  bzero(din.addrs, sizeof(din.addrs));
+  memmove(din.addrs, p, n);
+  din.size = xint(n);
+  winode(inum, &din);
+}
+
+// Hash of a directory entry name; the same as fs.c's.
+uint
+dirhash(char *name)
+{
+  uint h;
+  int i;
+
+  h = 2166136261;  // FNV-1a
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = (h ^ (uchar)name[i]) * 16777619;
+  return h;
+}
+
+// Write the n entries at de, "." and ".." first, into the
+// empty directory inum: as one block if they fit, otherwise
+// hashed, with the smallest index whose buckets all fit.
+void
+dirwrite(uint inum, struct dirent *de, int n)
+{
+  char buf[BSIZE];
+  struct dinode din;
+  struct dirent *p;
+  int cnt[NDIRINDEX];
+  int i, j, nb;
+
+  if(n <= NDIRENT){
+    bzero(buf, BSIZE);
+    memmove(buf, de, n*sizeof(*de));
+    iappend(inum, buf, BSIZE);
+    return;
+  }
+
+  for(nb = 2; ; nb *= 2){
+    assert(nb <= NDIRINDEX);
+    bzero(cnt, sizeof(cnt));
+    for(i = 2; i < n; i++)
+      cnt[dirhash(de[i].name) & (nb-1)]++;
+    for(j = 0; j < nb && cnt[j] <= NDIRENT; j++)
+      ;
+    if(j == nb)
+      break;
+  }
+
+  bzero(buf, BSIZE);
+  memmove(buf, de, 2*sizeof(*de));
+  for(i = 0; (1 << i) < nb; i++)
+    ;
+  ((struct dirhead*)buf + 2)->depth = xshort(i);
+  for(j = 0; j < nb; j++)
+    DIRBUCKET(buf, j) = xshort(1 + j);
+  iappend(inum, buf, BSIZE);
+
+  for(j = 0; j < nb; j++){
+    bzero(buf, BSIZE);
+    p = (struct dirent*)buf;
+    for(i = 2; i < n; i++)
+      if((dirhash(de[i].name) & (nb-1)) == j)
+        *p++ = de[i];
+    iappend(inum, buf, BSIZE);
+  }
+
+  rinode(inum, &din);
+  din.flags = xshort(xshort(din.flags) | I_DIRHASH);
+  winode(inum, &din);
+}
@@ -11,15 +11,23 @@
 
 #define CR4_PSE         0x00000010      // Page size extension
 
+// Model-specific registers for sysenter/sysexit
+#define MSR_SYSENTER_CS   0x174   // kernel code selector
+#define MSR_SYSENTER_ESP  0x175   // kernel stack pointer
+#define MSR_SYSENTER_EIP  0x176   // kernel entry point
+
+#define CPUID_SEP       (1<<11)   // cpuid 1 %edx: sysenter/sysexit
+
 // various segment selectors.
 #define SEG_KCODE 1  // kernel code
 #define SEG_KDATA 2  // kernel data+stack
 #define SEG_UCODE 3  // user code
 #define SEG_UDATA 4  // user data+stack
 #define SEG_TSS   5  // this process's task state
+#define SEG_UVDSO 6  // this process's slot in the vdso page
 
 // cpu->gdt[NSEGS] holds the above segments.
-#define NSEGS     6
+#define NSEGS     7
 
 #ifndef __ASSEMBLER__
 // Segment Descriptor
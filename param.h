@@ -6,14 +6,34 @@
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
 #define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NINODE       50  // minimum number of active i-nodes
+#define ICACHEFRAC 1024  // inode cache gets 1/ICACHEFRAC of memory
+#define NDENTRY     512  // directory entries cached
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
+#define TMPDEV        2  // device number of every tmpfs
+#define NTMPINODE   200  // inodes in all tmpfs file systems
+#define TMPPAGES   4096  // pages of memory all tmpfs file systems may use
+#define NMOUNT        4  // mounted file systems
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       1000  // size of file system in blocks
+#define LOGSIZE      (MAXOPBLOCKS*6)  // max data blocks in on-disk log
+#define NBUF         (LOGSIZE*2+MAXOPBLOCKS*2)  // size of disk block cache
+#define LOGWINDOW    1  // ticks a shared transaction waits for more ops
+#define LOGDELAY   100  // ticks an FS_ASYNC transaction may stay open
+
+// Log blocks each kind of FS operation reserves with begin_op().
+// begin_op() adds the cost of freeing an inode on top.
+#define OP_IPUT      0            // close, chdir, exec, exit: iput() only
+#define OP_UNLINK    3            // dir block, parent and child inodes
+#define OP_LINK      8            // inode; parent's index, 2 buckets, bitmap, inode, 2 extent
+#define OP_CREATE   10            // OP_LINK plus the new dir's block and bitmap
+#define OP_WRITE     MAXOPBLOCKS  // one chunk of filewrite()
+#define BULKBLOCKS    64  // most blocks one transaction of a large write covers
+#define FSSIZE  (2000*1024/BSIZE)  // default size of file system in blocks (mkfs -s)
+#define NGROUP        64  // max allocation groups, i.e. bitmap blocks
+#define IOSCHED  "deadline"  // disk request order: fifo, clook or deadline
+#define RINGTICK       4  // ring entries a clock tick performs
 // MODIFIED CODE ---------------------------------------------------------->
 #define NRESOURCE    4
 // MODIFIED CODE ---------------------------------------------------------->
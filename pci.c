@@ -0,0 +1,93 @@
+// Minimal PCI support: enough to find a device on bus 0,
+// read its base address registers and interrupt line,
+// and turn on bus mastering so that it can do DMA.
+// QEMU's PC machine puts every device on bus 0, so
+// bridges are not followed.
+
+#include "types.h"
+#include "defs.h"
+#include "x86.h"
+#include "pci.h"
+
+static uint
+confaddr(int bus, int dev, int func, int off)
+{
+  return 0x80000000 | (bus << 16) | (dev << 11) | (func << 8) | (off & 0xFC);
+}
+
+uint
+pciconfread(struct pcidev *d, int off)
+{
+  outl(PCI_CONFADDR, confaddr(d->bus, d->dev, d->func, off));
+  return inl(PCI_CONFDATA);
+}
+
+void
+pciconfwrite(struct pcidev *d, int off, uint v)
+{
+  outl(PCI_CONFADDR, confaddr(d->bus, d->dev, d->func, off));
+  outl(PCI_CONFDATA, v);
+}
+
+// Fill in d from the configuration space of bus 0, dev, func.
+// Return 0 if there is no such function.
+static int
+pciprobe(int dev, int func, struct pcidev *d)
+{
+  uint id, class;
+  int i;
+
+  d->bus = 0;
+  d->dev = dev;
+  d->func = func;
+  id = pciconfread(d, PCI_ID);
+  if((id & 0xFFFF) == 0xFFFF)
+    return 0;
+  d->vendor = id & 0xFFFF;
+  d->device = id >> 16;
+  class = pciconfread(d, PCI_CLASS);
+  d->class = class >> 24;
+  d->subclass = class >> 16;
+  d->progif = class >> 8;
+  for(i = 0; i < 6; i++)
+    d->bar[i] = pciconfread(d, PCI_BAR0 + 4*i);
+  d->irq = pciconfread(d, PCI_INTR) & 0xFF;
+  return 1;
+}
+
+// Find the first function matching vendor and device
+// (either may be PCI_ANY) and, if class >= 0, class and subclass.
+// Return 0 on success, -1 if there is none.
+int
+pcifind(uint vendor, uint device, int class, int subclass, struct pcidev *d)
+{
+  int dev, func, nfunc;
+
+  for(dev = 0; dev < 32; dev++){
+    nfunc = 1;
+    for(func = 0; func < nfunc; func++){
+      if(!pciprobe(dev, func, d))
+        continue;
+      if(func == 0 && (pciconfread(d, PCI_HDR) >> 16) & PCI_HDR_MULTI)
+        nfunc = 8;
+      if(vendor != PCI_ANY && d->vendor != vendor)
+        continue;
+      if(device != PCI_ANY && d->device != device)
+        continue;
+      if(class >= 0 && (d->class != class || d->subclass != subclass))
+        continue;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+// Let d decode I/O and memory accesses and master the bus.
+void
+pcienable(struct pcidev *d)
+{
+  uint cmd;
+
+  cmd = pciconfread(d, PCI_CMD) & 0xFFFF;
+  pciconfwrite(d, PCI_CMD, cmd | PCI_CMD_IO | PCI_CMD_MEM | PCI_CMD_MASTER);
+}
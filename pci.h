@@ -0,0 +1,41 @@
+// PCI bus: configuration space access via mechanism #1
+// (I/O ports 0xCF8/0xCFC), which every PC chipset supports.
+
+#define PCI_CONFADDR  0xCF8
+#define PCI_CONFDATA  0xCFC
+
+// Configuration space registers (byte offsets).
+#define PCI_ID        0x00  // device id << 16 | vendor id
+#define PCI_CMD       0x04  // status << 16 | command
+#define PCI_CLASS     0x08  // class << 24 | subclass << 16 | progif << 8
+#define PCI_HDR       0x0C  // header type in bits 16-23
+#define PCI_BAR0      0x10  // base address registers 0..5
+#define PCI_INTR      0x3C  // interrupt line in bits 0-7
+
+// Command register bits.
+#define PCI_CMD_IO      0x1  // respond to I/O space accesses
+#define PCI_CMD_MEM     0x2  // respond to memory space accesses
+#define PCI_CMD_MASTER  0x4  // allow device to act as bus master (DMA)
+
+#define PCI_HDR_MULTI  0x80  // device has more than one function
+#define PCI_BAR_IO     0x1   // BAR maps I/O space, not memory
+
+#define PCI_ANY  0xFFFF     // wildcard for pcifind() vendor/device
+
+// Mass storage class and its IDE subclass.
+#define PCI_CLASS_STORAGE  0x01
+#define PCI_SUBCLASS_IDE   0x01
+
+// A PCI function found by pcifind().
+struct pcidev {
+  uchar bus;
+  uchar dev;
+  uchar func;
+  ushort vendor;
+  ushort device;
+  uchar class;
+  uchar subclass;
+  uchar progif;
+  uint bar[6];   // raw base address registers
+  uchar irq;     // legacy interrupt line assigned by the BIOS
+};
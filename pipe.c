@@ -7,18 +7,58 @@
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "fcntl.h"
 
-#define PIPESIZE 512
+// The buffer is a ring of whole pages, a power of two of
+// them so that the free-running nread and nwrite counters
+// index it correctly when they wrap.  Data is copied a
+// contiguous span at a time, and sleepers are woken only
+// when the pipe stops being empty or full.
+//
+// The splice functions copy between the ring and a file
+// without the pipe's lock, since reading and writing files
+// sleeps.  While one does, rbusy or wbusy keeps other readers
+// or writers, and resizing, away from the pipe.
+#define PIPEPAGES     4   // default buffer size, in pages
+#define PIPEMAXPAGES 16   // largest buffer pipesize() allows
 
 struct pipe {
   struct spinlock lock;
-  char data[PIPESIZE];
+  char *page[PIPEMAXPAGES];
+  uint size;      // bytes in the ring
   uint nread;     // number of bytes read
   uint nwrite;    // number of bytes written
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
+  int rbusy;      // a splice is reading the ring
+  int wbusy;      // a splice is writing the ring
+  struct waitq rq;  // readers waiting for data
+  struct waitq wq;  // writers waiting for room
 };
 
+static void
+freepages(char **page, uint size)
+{
+  int i;
+
+  for(i = 0; i < size / PGSIZE; i++)
+    kfree(page[i]);
+}
+
+static int
+allocpages(char **page, uint size)
+{
+  int i;
+
+  for(i = 0; i < size / PGSIZE; i++){
+    if((page[i] = kalloc()) == 0){
+      freepages(page, i * PGSIZE);
+      return -1;
+    }
+  }
+  return 0;
+}
+
 int
 pipealloc(struct file **f0, struct file **f1)
 {
@@ -30,10 +70,17 @@ pipealloc(struct file **f0, struct file **f1)
     goto bad;
   if((p = (struct pipe*)kalloc()) == 0)
     goto bad;
+  p->size = PIPEPAGES * PGSIZE;
+  if(allocpages(p->page, p->size) < 0)
+    goto bad;
   p->readopen = 1;
   p->writeopen = 1;
   p->nwrite = 0;
   p->nread = 0;
+  p->rbusy = 0;
+  p->wbusy = 0;
+  p->rq.head = 0;
+  p->wq.head = 0;
   initlock(&p->lock, "pipe");
   (*f0)->type = FD_PIPE;
   (*f0)->readable = 1;
@@ -62,60 +109,305 @@ pipeclose(struct pipe *p, int writable)
   acquire(&p->lock);
   if(writable){
     p->writeopen = 0;
-    wakeup(&p->nread);
+    waitqwakeup(&p->rq);
   } else {
     p->readopen = 0;
-    wakeup(&p->nwrite);
+    waitqwakeup(&p->wq);
   }
   if(p->readopen == 0 && p->writeopen == 0){
     release(&p->lock);
+    freepages(p->page, p->size);
     kfree((char*)p);
   } else
     release(&p->lock);
 }
 
+// Resize p's buffer to at least n bytes, rounded up to a
+// power of two pages, keeping what it holds.  If n is 0,
+// just report the size.  Return the size, or -1 if n is
+// too big or the data would not fit.
+int
+pipesize(struct pipe *p, int n)
+{
+  char *page[PIPEMAXPAGES], *t;
+  uint size, old, len, i, m, off;
+
+  if(n < 0 || n > PIPEMAXPAGES * PGSIZE)
+    return -1;
+  if(n == 0){
+    acquire(&p->lock);
+    n = p->size;
+    release(&p->lock);
+    return n;
+  }
+  for(size = PGSIZE; size < n; size *= 2)
+    ;
+  if(allocpages(page, size) < 0)
+    return -1;
+
+  acquire(&p->lock);
+  while(p->rbusy || p->wbusy)
+    waitqsleep(p->rbusy ? &p->rq : &p->wq, &p->lock);
+  len = p->nwrite - p->nread;
+  if(len > size){
+    release(&p->lock);
+    freepages(page, size);
+    return -1;
+  }
+  // Copy the data to the start of the new ring.
+  for(i = 0; i < len; i += m){
+    off = (p->nread + i) % p->size;
+    m = PGSIZE - off % PGSIZE;
+    if(m > PGSIZE - i % PGSIZE)
+      m = PGSIZE - i % PGSIZE;
+    if(m > len - i)
+      m = len - i;
+    memmove(page[i / PGSIZE] + i % PGSIZE, p->page[off / PGSIZE] + off % PGSIZE, m);
+  }
+  if(len == p->size)
+    waitqwakeup(&p->wq);  // no longer full
+  for(i = 0; i < PIPEMAXPAGES; i++){
+    t = p->page[i];
+    p->page[i] = page[i];
+    page[i] = t;
+  }
+  old = p->size;
+  p->size = size;
+  p->nread = 0;
+  p->nwrite = len;
+  release(&p->lock);
+  freepages(page, old);
+  return size;
+}
+
+// Report which poll() events hold for the read or the
+// write end of p, and add w to the matching wait queue.
+int
+pipepoll(struct pipe *p, int writable, struct waiter *w)
+{
+  int ev;
+
+  ev = 0;
+  acquire(&p->lock);
+  if(writable){
+    waitqadd(&p->wq, w);
+    if(p->readopen == 0)
+      ev |= POLLERR;
+    else if(p->nwrite != p->nread + p->size)
+      ev |= POLLOUT;
+  } else {
+    waitqadd(&p->rq, w);
+    if(p->nread != p->nwrite)
+      ev |= POLLIN;
+    if(p->writeopen == 0)
+      ev |= POLLHUP;
+  }
+  release(&p->lock);
+  return ev;
+}
+
 //PAGEBREAK: 40
+// Write n bytes to p.  Without nonblock, wait until all
+// are in; with it, write what fits and fail if none does.
 int
-pipewrite(struct pipe *p, char *addr, int n)
+pipewrite(struct pipe *p, char *addr, int n, int nonblock)
 {
   int i;
+  uint m, off;
 
   acquire(&p->lock);
-  for(i = 0; i < n; i++){
-    while(p->nwrite == p->nread + PIPESIZE){  //DOC: pipewrite-full
+  for(i = 0; i < n; i += m){
+    while(p->wbusy || p->nwrite == p->nread + p->size){  //DOC: pipewrite-full
       if(p->readopen == 0 || myproc()->killed){
         release(&p->lock);
         return -1;
       }
-      wakeup(&p->nread);
-      sleep(&p->nwrite, &p->lock);  //DOC: pipewrite-sleep
+      if(nonblock){
+        release(&p->lock);
+        return i > 0 ? i : -1;
+      }
+      waitqsleep(&p->wq, &p->lock);  //DOC: pipewrite-sleep
     }
-    p->data[p->nwrite++ % PIPESIZE] = addr[i];
+    // Copy as much as fits before the end of a page.
+    off = p->nwrite % p->size;
+    m = PGSIZE - off % PGSIZE;
+    if(m > n - i)
+      m = n - i;
+    if(m > p->nread + p->size - p->nwrite)
+      m = p->nread + p->size - p->nwrite;
+    memmove(p->page[off / PGSIZE] + off % PGSIZE, addr + i, m);
+    if(p->nwrite == p->nread)
+      waitqwakeup(&p->rq);  //DOC: pipewrite-wakeup1
+    p->nwrite += m;
   }
-  wakeup(&p->nread);  //DOC: pipewrite-wakeup1
   release(&p->lock);
   return n;
 }
 
+// Read up to n bytes from p, waiting until there are
+// some unless nonblock is set.
 int
-piperead(struct pipe *p, char *addr, int n)
+piperead(struct pipe *p, char *addr, int n, int nonblock)
 {
   int i;
+  uint m, off;
 
   acquire(&p->lock);
-  while(p->nread == p->nwrite && p->writeopen){  //DOC: pipe-empty
+  while(p->rbusy || (p->nread == p->nwrite && p->writeopen)){  //DOC: pipe-empty
+    if(myproc()->killed || nonblock){
+      release(&p->lock);
+      return -1;
+    }
+    waitqsleep(&p->rq, &p->lock); //DOC: piperead-sleep
+  }
+  for(i = 0; i < n && p->nread != p->nwrite; i += m){  //DOC: piperead-copy
+    off = p->nread % p->size;
+    m = PGSIZE - off % PGSIZE;
+    if(m > n - i)
+      m = n - i;
+    if(m > p->nwrite - p->nread)
+      m = p->nwrite - p->nread;
+    memmove(addr + i, p->page[off / PGSIZE] + off % PGSIZE, m);
+    if(p->nwrite == p->nread + p->size)
+      waitqwakeup(&p->wq);  //DOC: piperead-wakeup
+    p->nread += m;
+  }
+  release(&p->lock);
+  return i;
+}
+
+//PAGEBREAK: 40
+// Fill p with up to n bytes read from file f, straight
+// from the buffer cache into the ring.  Like pipewrite(),
+// wait for room until all n are in, but stop at the end
+// of the file.  Return the number of bytes moved.
+int
+pipesplicein(struct pipe *p, struct file *f, int n)
+{
+  int i, r;
+  uint m, off;
+
+  r = 0;
+  acquire(&p->lock);
+  for(i = 0; i < n; i += r){
+    while(p->wbusy || p->nwrite == p->nread + p->size){
+      if(p->readopen == 0 || myproc()->killed){
+        release(&p->lock);
+        return i > 0 ? i : -1;
+      }
+      waitqsleep(&p->wq, &p->lock);
+    }
+    off = p->nwrite % p->size;
+    m = PGSIZE - off % PGSIZE;
+    if(m > n - i)
+      m = n - i;
+    if(m > p->nread + p->size - p->nwrite)
+      m = p->nread + p->size - p->nwrite;
+    p->wbusy = 1;
+    release(&p->lock);
+
+    ilock(f->ip);
+    if((r = readi(f->ip, p->page[off / PGSIZE] + off % PGSIZE, f->off, m)) > 0)
+      f->off += r;
+    iunlock(f->ip);
+
+    acquire(&p->lock);
+    p->wbusy = 0;
+    waitqwakeup(&p->wq);
+    if(r <= 0)
+      break;
+    if(p->nwrite == p->nread)
+      waitqwakeup(&p->rq);
+    p->nwrite += r;
+    if(r < m){
+      i += r;
+      break;
+    }
+  }
+  release(&p->lock);
+  return i > 0 ? i : r;
+}
+
+// Move up to n bytes from p to file f, straight from the
+// ring.  Like piperead(), wait only until there is some data.
+int
+pipespliceout(struct pipe *p, struct file *f, int n)
+{
+  int i, r;
+  uint m, off;
+
+  acquire(&p->lock);
+  while(p->rbusy || (p->nread == p->nwrite && p->writeopen)){
     if(myproc()->killed){
       release(&p->lock);
       return -1;
     }
-    sleep(&p->nread, &p->lock); //DOC: piperead-sleep
+    waitqsleep(&p->rq, &p->lock);
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(p->nread == p->nwrite)
+  r = 0;
+  for(i = 0; i < n && p->nread != p->nwrite; i += r){
+    off = p->nread % p->size;
+    m = PGSIZE - off % PGSIZE;
+    if(m > n - i)
+      m = n - i;
+    if(m > p->nwrite - p->nread)
+      m = p->nwrite - p->nread;
+    p->rbusy = 1;
+    release(&p->lock);
+
+    r = filewrite(f, p->page[off / PGSIZE] + off % PGSIZE, m);
+
+    acquire(&p->lock);
+    p->rbusy = 0;
+    waitqwakeup(&p->rq);
+    if(r <= 0)
       break;
-    addr[i] = p->data[p->nread++ % PIPESIZE];
+    if(p->nwrite == p->nread + p->size)
+      waitqwakeup(&p->wq);
+    p->nread += r;
   }
-  wakeup(&p->nwrite);  //DOC: piperead-wakeup
   release(&p->lock);
-  return i;
+  return i > 0 ? i : r;
+}
+
+// Copy up to n bytes from in to out without consuming them.
+// Wait until in has some data, and for room in out.
+int
+pipetee(struct pipe *in, struct pipe *out, int n)
+{
+  int i, r;
+  uint m, off, start, len;
+
+  acquire(&in->lock);
+  while(in->rbusy || (in->nread == in->nwrite && in->writeopen)){
+    if(myproc()->killed){
+      release(&in->lock);
+      return -1;
+    }
+    waitqsleep(&in->rq, &in->lock);
+  }
+  // Readers of in wait while out may be full,
+  // so the data copied stays put.
+  start = in->nread;
+  len = in->nwrite - in->nread;
+  in->rbusy = 1;
+  release(&in->lock);
+
+  r = 0;
+  for(i = 0; i < n && i < len; i += m){
+    off = (start + i) % in->size;
+    m = PGSIZE - off % PGSIZE;
+    if(m > n - i)
+      m = n - i;
+    if(m > len - i)
+      m = len - i;
+    if((r = pipewrite(out, in->page[off / PGSIZE] + off % PGSIZE, m, 0)) < 0)
+      break;
+  }
+
+  acquire(&in->lock);
+  in->rbusy = 0;
+  waitqwakeup(&in->rq);
+  release(&in->lock);
+  return i > 0 ? i : r;
 }
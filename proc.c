@@ -108,6 +108,7 @@ allocproc(void)
 found:
   p->state = EMBRYO;
   p->pid = nextpid++;
+  p->ring = 0;
 
   release(&ptable.lock);
 
@@ -178,6 +179,25 @@ void userinit(void)
   release(&ptable.lock);
 }
 
+// Start a process that runs fn in the kernel and never
+// returns to user space.  fn must not return.
+void kproc(char *name, void (*fn)(void))
+{
+  struct proc *p;
+
+  if ((p = allocproc()) == 0)
+    panic("kproc: no procs");
+  if ((p->pgdir = setupkvm()) == 0)
+    panic("kproc: out of memory");
+  safestrcpy(p->name, name, sizeof(p->name));
+  // forkret() returns to fn instead of trapret.
+  *(uint *)(p->context + 1) = (uint)fn;
+
+  acquire(&ptable.lock);
+  p->state = RUNNABLE;
+  release(&ptable.lock);
+}
+
 // Grow current process's memory by n bytes.
 // Return 0 on success, -1 on failure.
 int growproc(int n)
@@ -271,7 +291,7 @@ void exit(void)
     }
   }
 
-  begin_op();
+  begin_op(OP_IPUT);
   iput(curproc->cwd);
   end_op();
   curproc->cwd = 0;
@@ -381,6 +401,7 @@ void scheduler(void)
       // before jumping back to us.
       c->proc = p;
       switchuvm(p);
+      vdsoswitch(p, p - ptable.proc);
       p->state = RUNNING;
 
       swtch(&(c->scheduler), p->context);
@@ -510,6 +531,76 @@ void wakeup(void *chan)
   release(&ptable.lock);
 }
 
+// Sleep on wait queue q.
+void waitqsleep(struct waitq *q, struct spinlock *lk)
+{
+  sleep(q, lk);
+}
+
+// Wake everything waiting on q: processes sleeping on it,
+// and those in poll() with a waiter on it.
+void waitqwakeup(struct waitq *q)
+{
+  struct waiter *w;
+
+  acquire(&ptable.lock);
+  wakeup1(q);
+  for (w = q->head; w; w = w->next)
+  {
+    *w->woken = 1;
+    // A process only has waiters while in poll(),
+    // so any sleep it is in is waitqblock()'s.
+    if (w->proc->state == SLEEPING)
+      w->proc->state = RUNNABLE;
+  }
+  release(&ptable.lock);
+}
+
+// Have waitqwakeup(q) set *w->woken and wake the current
+// process, until waitqremove(w).  w may be 0.
+void waitqadd(struct waitq *q, struct waiter *w)
+{
+  if (w == 0)
+    return;
+  acquire(&ptable.lock);
+  w->proc = myproc();
+  w->q = q;
+  w->next = q->head;
+  q->head = w;
+  release(&ptable.lock);
+}
+
+// Take w back off its queue, if it is on one.
+void waitqremove(struct waiter *w)
+{
+  struct waiter **pp;
+
+  if (w->q == 0)
+    return;
+  acquire(&ptable.lock);
+  for (pp = &w->q->head; *pp; pp = &(*pp)->next)
+  {
+    if (*pp == w)
+    {
+      *pp = w->next;
+      break;
+    }
+  }
+  w->q = 0;
+  release(&ptable.lock);
+}
+
+// Sleep until one of the queues the current process
+// has waiters on is woken, unless one already was.
+// With tick set, also wake up at the next clock tick.
+void waitqblock(int *woken, int tick)
+{
+  acquire(&ptable.lock);
+  if (!*woken && !myproc()->killed)
+    sleep(tick ? (void *)&ticks : (void *)woken, &ptable.lock);
+  release(&ptable.lock);
+}
+
 // Kill the process with the given pid.
 // Process won't exit until it returns
 // to user space (see trap in trap.c).
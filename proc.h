@@ -72,8 +72,28 @@ struct proc
   int killed;                 // If non-zero, have been killed
   struct file *ofile[NOFILE]; // Open files
   struct inode *cwd;          // Current directory
+  int logres;                 // Log blocks reserved by begin_op()
+  uint ring;                  // User address of struct ring, or 0
   char name[16];              // Process name (debugging)
 };
+
+// A wait queue: something processes wait for, such as data
+// in a pipe.  A process waiting on one queue sleeps with the
+// queue as its channel; poll() waits on several at once by
+// adding a waiter to each.  ptable.lock protects the list.
+struct waiter
+{
+  struct proc *proc;
+  int *woken;           // set when the queue is woken
+  struct waitq *q;
+  struct waiter *next;
+};
+
+struct waitq
+{
+  struct waiter *head;
+};
+
 // MODIFIED CODE ---------------------------------------------------------->
 typedef struct resource
 {
@@ -0,0 +1,38 @@
+// Shared submission and completion rings for batched I/O.
+// A program registers a struct ring in its memory with
+// ringsetup(), fills in sq entries and advances sqtail.
+// The kernel performs them in order when the program calls
+// ringenter(), or a few at each clock tick that interrupts
+// it, and appends a completion to cq for each.  The program
+// only writes sqtail and cqhead, the kernel sqhead and cqtail.
+
+#define RINGSIZE 64  // entries in each ring
+
+// Operations.
+#define RING_NOP    0
+#define RING_READ   1
+#define RING_WRITE  2
+#define RING_OPEN   3  // addr is the path, n the mode
+#define RING_CLOSE  4
+
+struct ringsqe {
+  int op;
+  int fd;
+  uint addr;  // buffer or path
+  int n;      // byte count, or open mode
+  uint data;  // handed back in the completion
+};
+
+struct ringcqe {
+  int res;    // what the system call would have returned
+  uint data;
+};
+
+struct ring {
+  uint sqhead;  // next entry the kernel performs
+  uint sqtail;  // next entry the program fills in
+  uint cqhead;  // next completion the program takes
+  uint cqtail;  // next completion the kernel fills in
+  struct ringsqe sq[RINGSIZE];
+  struct ringcqe cq[RINGSIZE];
+};
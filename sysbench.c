@@ -0,0 +1,58 @@
+// Measure system call latency: getpid() through the
+// sysenter stubs in usys.S against the int $T_SYSCALL gate,
+// and against reading the pid from the vdso page.
+
+#include "types.h"
+#include "user.h"
+#include "syscall.h"
+#include "traps.h"
+#include "vdso.h"
+
+#define N 100000
+
+static uint
+rdtsc(void)
+{
+  uint lo, hi;
+
+  asm volatile("rdtsc" : "=a" (lo), "=d" (hi));
+  return lo;
+}
+
+static int
+intgetpid(void)
+{
+  int r;
+
+  asm volatile("int %1" : "=a" (r) : "i" (T_SYSCALL), "0" (SYS_getpid) : "memory");
+  return r;
+}
+
+int
+main(int argc, char *argv[])
+{
+  uint t0, t1, t2, t3;
+  int i;
+
+  // Warm up both paths.
+  getpid();
+  intgetpid();
+  vgetpid();
+
+  t0 = rdtsc();
+  for(i = 0; i < N; i++)
+    intgetpid();
+  t1 = rdtsc();
+  for(i = 0; i < N; i++)
+    getpid();
+  t2 = rdtsc();
+  for(i = 0; i < N; i++)
+    vgetpid();
+  t3 = rdtsc();
+
+  if(!((struct vdso*)VDSO)->sysenter)
+    printf(1, "no sysenter: the stubs use int too\n");
+  printf(1, "getpid: int %d cycles, sysenter %d cycles, vdso %d cycles\n",
+         (t1 - t0) / N, (t2 - t1) / N, (t3 - t2) / N);
+  exit();
+}
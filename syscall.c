@@ -108,6 +108,21 @@ extern int sys_requestresource(void);
 extern int sys_writeresource(void);
 extern int sys_readresource(void);
 extern int sys_releaseresource(void);
+extern int sys_fallocate(void);
+extern int sys_pipesize(void);
+extern int sys_splice(void);
+extern int sys_tee(void);
+extern int sys_sendfile(void);
+extern int sys_poll(void);
+extern int sys_fcntl(void);
+extern int sys_ringsetup(void);
+extern int sys_ringenter(void);
+extern int sys_pread(void);
+extern int sys_pwrite(void);
+extern int sys_readv(void);
+extern int sys_writev(void);
+extern int sys_fsync(void);
+extern int sys_mount(void);
 // MODIFIED CODE ---------------------------------------------------------->
 static int (*syscalls[])(void) = {
     [SYS_fork] sys_fork,
@@ -138,6 +153,21 @@ static int (*syscalls[])(void) = {
     [SYS_writeresource] sys_writeresource,
     [SYS_readresource] sys_readresource,
     [SYS_releaseresource] sys_releaseresource,
+    [SYS_fallocate] sys_fallocate,
+    [SYS_pipesize] sys_pipesize,
+    [SYS_splice] sys_splice,
+    [SYS_tee] sys_tee,
+    [SYS_sendfile] sys_sendfile,
+    [SYS_poll] sys_poll,
+    [SYS_fcntl] sys_fcntl,
+    [SYS_ringsetup] sys_ringsetup,
+    [SYS_ringenter] sys_ringenter,
+    [SYS_pread] sys_pread,
+    [SYS_pwrite] sys_pwrite,
+    [SYS_readv] sys_readv,
+    [SYS_writev] sys_writev,
+    [SYS_fsync] sys_fsync,
+    [SYS_mount] sys_mount,
     // MODIFIED CODE ---------------------------------------------------------->
 };
 void syscall(void)
@@ -29,4 +29,19 @@
 #define SYS_writeresource 25
 #define SYS_readresource 26
 #define SYS_releaseresource 27
+#define SYS_fallocate 28
+#define SYS_pipesize 29
+#define SYS_splice 30
+#define SYS_tee 31
+#define SYS_sendfile 32
+#define SYS_poll 33
+#define SYS_fcntl 34
+#define SYS_ringsetup 35
+#define SYS_ringenter 36
+#define SYS_pread 37
+#define SYS_pwrite 38
+#define SYS_readv 39
+#define SYS_writev 40
+#define SYS_fsync 41
+#define SYS_mount 42
 // MODIFIED CODE ---------------------------------------------------------->
@@ -15,6 +15,7 @@
 #include "sleeplock.h"
 #include "file.h"
 #include "fcntl.h"
+#include "ring.h"
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
@@ -90,6 +91,129 @@ sys_write(void)
   return filewrite(f, p, n);
 }
 
+int
+sys_pread(void)
+{
+  struct file *f;
+  int n, off;
+  char *p;
+
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0 || argint(3, &off) < 0)
+    return -1;
+  return filepread(f, p, n, off);
+}
+
+int
+sys_pwrite(void)
+{
+  struct file *f;
+  int n, off;
+  char *p;
+
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0 || argint(3, &off) < 0)
+    return -1;
+  return filepwrite(f, p, n, off);
+}
+
+// Check that user memory [addr, addr+n) is in the process.
+static int
+uvalid(uint addr, int n)
+{
+  struct proc *curproc = myproc();
+
+  return n >= 0 && addr < curproc->sz && addr + n <= curproc->sz;
+}
+
+// Fetch readv()/writev() arguments: the file, and a
+// checked copy of the buffer list in iov.  Return the
+// number of buffers, or -1.
+static int
+argiov(struct file **pf, struct iovec *iov)
+{
+  struct iovec *uiov;
+  int i, cnt;
+
+  if(argfd(0, 0, pf) < 0 || argint(2, &cnt) < 0 || cnt < 0 || cnt > IOV_MAX)
+    return -1;
+  if(argptr(1, (char**)&uiov, cnt*sizeof(*uiov)) < 0)
+    return -1;
+  for(i = 0; i < cnt; i++){
+    iov[i] = uiov[i];
+    if(!uvalid((uint)iov[i].base, iov[i].len))
+      return -1;
+  }
+  return cnt;
+}
+
+// Read into each buffer in turn, stopping early at
+// the end of the file or when a pipe runs dry.
+int
+sys_readv(void)
+{
+  struct iovec iov[IOV_MAX];
+  struct file *f;
+  int i, cnt, r, tot;
+
+  if((cnt = argiov(&f, iov)) < 0)
+    return -1;
+  tot = 0;
+  for(i = 0; i < cnt; i++){
+    if((r = fileread(f, iov[i].base, iov[i].len)) < 0)
+      return tot > 0 ? tot : -1;
+    tot += r;
+    if(r < iov[i].len)
+      break;
+  }
+  return tot;
+}
+
+int
+sys_writev(void)
+{
+  struct iovec iov[IOV_MAX];
+  struct file *f;
+  int i, cnt, r, tot;
+
+  if((cnt = argiov(&f, iov)) < 0)
+    return -1;
+  tot = 0;
+  for(i = 0; i < cnt; i++){
+    if((r = filewrite(f, iov[i].base, iov[i].len)) < 0)
+      return tot > 0 ? tot : -1;
+    tot += r;
+    if(r < iov[i].len)
+      break;
+  }
+  return tot;
+}
+
+// Wait until the file's changes, and everything else
+// written so far, are on disk.
+int
+sys_fsync(void)
+{
+  struct file *f;
+
+  if(argfd(0, 0, &f) < 0 || f->type != FD_INODE)
+    return -1;
+  if(f->ip->dev != TMPDEV)
+    log_sync();
+  return 0;
+}
+
+// Reserve space for the file to grow to n bytes
+// without allocating any more blocks.
+int
+sys_fallocate(void)
+{
+  struct file *f;
+  int n;
+
+  if(argfd(0, 0, &f) < 0 || argint(1, &n) < 0)
+    return -1;
+  return filefallocate(f, n);
+}
+
 int
 sys_close(void)
 {
@@ -124,7 +248,7 @@ sys_link(void)
   if(argstr(0, &old) < 0 || argstr(1, &new) < 0)
     return -1;
 
-  begin_op();
+  begin_op(OP_LINK);
   if((ip = namei(old)) == 0){
     end_op();
     return -1;
@@ -192,7 +316,7 @@ sys_unlink(void)
   if(argstr(0, &path) < 0)
     return -1;
 
-  begin_op();
+  begin_op(OP_UNLINK);
   if((dp = nameiparent(path, name)) == 0){
     end_op();
     return -1;
@@ -206,6 +330,10 @@ sys_unlink(void)
 
   if((ip = dirlookup(dp, name, &off)) == 0)
     goto bad;
+  if(ismountpoint(ip)){
+    iput(ip);
+    goto bad;
+  }
   ilock(ip);
 
   if(ip->nlink < 1)
@@ -218,6 +346,7 @@ sys_unlink(void)
   memset(&de, 0, sizeof(de));
   if(writei(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
     panic("unlink: writei");
+  dcacheenter(dp, name, 0, 0);
   if(ip->type == T_DIR){
     dp->nlink--;
     iupdate(dp);
@@ -257,8 +386,10 @@ create(char *path, short type, short major, short minor)
     return 0;
   }
 
-  if((ip = ialloc(dp->dev, type)) == 0)
-    panic("create: ialloc");
+  if((ip = ialloc(dp->dev, type)) == 0){
+    iunlockput(dp);  // a tmpfs with no inodes left
+    return 0;
+  }
 
   ilock(ip);
   ip->major = major;
@@ -266,34 +397,37 @@ create(char *path, short type, short major, short minor)
   ip->nlink = 1;
   iupdate(ip);
 
-  if(type == T_DIR){  // Create . and .. entries.
+  // Create . and .. entries, then the name in dp.  Only a
+  // full hash index or a full tmpfs makes these fail.
+  // No ip->nlink++ for ".": avoid cyclic ref count.
+  if((type == T_DIR && (dirlink(ip, ".", ip->inum) < 0 ||
+                        dirlink(ip, "..", dp->inum) < 0)) ||
+     dirlink(dp, name, ip->inum) < 0){
+    ip->nlink = 0;  // free it again
+    iupdate(ip);
+    iunlockput(ip);
+    iunlockput(dp);
+    return 0;
+  }
+  if(type == T_DIR){
     dp->nlink++;  // for ".."
     iupdate(dp);
-    // No ip->nlink++ for ".": avoid cyclic ref count.
-    if(dirlink(ip, ".", ip->inum) < 0 || dirlink(ip, "..", dp->inum) < 0)
-      panic("create dots");
   }
 
-  if(dirlink(dp, name, ip->inum) < 0)
-    panic("create: dirlink");
-
   iunlockput(dp);
 
   return ip;
 }
 
-int
-sys_open(void)
+// Open path and return a new fd for it.
+static int
+openpath(char *path, int omode)
 {
-  char *path;
-  int fd, omode;
+  int fd;
   struct file *f;
   struct inode *ip;
 
-  if(argstr(0, &path) < 0 || argint(1, &omode) < 0)
-    return -1;
-
-  begin_op();
+  begin_op((omode & O_CREATE) ? OP_CREATE : OP_IPUT);
 
   if(omode & O_CREATE){
     ip = create(path, T_FILE, 0, 0);
@@ -307,7 +441,7 @@ sys_open(void)
       return -1;
     }
     ilock(ip);
-    if(ip->type == T_DIR && omode != O_RDONLY){
+    if(ip->type == T_DIR && (omode & ~O_NONBLOCK) != O_RDONLY){
       iunlockput(ip);
       end_op();
       return -1;
@@ -329,16 +463,101 @@ sys_open(void)
   f->off = 0;
   f->readable = !(omode & O_WRONLY);
   f->writable = (omode & O_WRONLY) || (omode & O_RDWR);
+  f->nonblock = (omode & O_NONBLOCK) != 0;
   return fd;
 }
 
+int
+sys_open(void)
+{
+  char *path;
+  int omode;
+
+  if(argstr(0, &path) < 0 || argint(1, &omode) < 0)
+    return -1;
+  return openpath(path, omode);
+}
+
+// Get or set fd's O_NONBLOCK flag.
+int
+sys_fcntl(void)
+{
+  struct file *f;
+  int cmd, arg;
+
+  if(argfd(0, 0, &f) < 0 || argint(1, &cmd) < 0 || argint(2, &arg) < 0)
+    return -1;
+  switch(cmd){
+  case F_GETFL:
+    return (f->readable ? (f->writable ? O_RDWR : O_RDONLY) : O_WRONLY) |
+           (f->nonblock ? O_NONBLOCK : 0);
+  case F_SETFL:
+    f->nonblock = (arg & O_NONBLOCK) != 0;
+    return 0;
+  }
+  return -1;
+}
+
+// Wait until one of the n fds in fds is ready for the
+// events asked for, or for timeout ticks (forever if
+// negative).  Return the number of ready fds.
+int
+sys_poll(void)
+{
+  struct pollfd *fds;
+  struct file *f[NOFILE];
+  struct waiter w[NOFILE];
+  int n, timeout, i, ready, woken;
+  uint start;
+
+  if(argint(1, &n) < 0 || argint(2, &timeout) < 0 || n < 0 || n > NOFILE)
+    return -1;
+  if(argptr(0, (void*)&fds, n*sizeof(fds[0])) < 0)
+    return -1;
+  // Hold references so that the files' wait queues
+  // stay put even if another thread closes the fds.
+  for(i = 0; i < n; i++){
+    f[i] = 0;
+    if(fds[i].fd >= 0 && fds[i].fd < NOFILE && myproc()->ofile[fds[i].fd])
+      f[i] = filedup(myproc()->ofile[fds[i].fd]);
+    w[i].woken = &woken;
+  }
+
+  start = ticks;
+  for(;;){
+    woken = 0;
+    ready = 0;
+    for(i = 0; i < n; i++){
+      fds[i].revents = 0;
+      w[i].q = 0;  // filepoll() only queues w for pipes and pollable devices
+      if(f[i])
+        fds[i].revents = filepoll(f[i], &w[i]) & (fds[i].events | POLLERR | POLLHUP);
+      else if(fds[i].fd >= 0)
+        fds[i].revents = POLLNVAL;
+      if(fds[i].revents)
+        ready++;
+    }
+    if(ready == 0 && timeout != 0 && (timeout < 0 || ticks - start < timeout))
+      waitqblock(&woken, timeout > 0);
+    for(i = 0; i < n; i++)
+      waitqremove(&w[i]);
+    if(ready || timeout == 0 || (timeout > 0 && ticks - start >= timeout) || myproc()->killed)
+      break;
+  }
+
+  for(i = 0; i < n; i++)
+    if(f[i])
+      fileclose(f[i]);
+  return myproc()->killed ? -1 : ready;
+}
+
 int
 sys_mkdir(void)
 {
   char *path;
   struct inode *ip;
 
-  begin_op();
+  begin_op(OP_CREATE);
   if(argstr(0, &path) < 0 || (ip = create(path, T_DIR, 0, 0)) == 0){
     end_op();
     return -1;
@@ -355,7 +574,7 @@ sys_mknod(void)
   char *path;
   int major, minor;
 
-  begin_op();
+  begin_op(OP_CREATE);
   if((argstr(0, &path)) < 0 ||
      argint(1, &major) < 0 ||
      argint(2, &minor) < 0 ||
@@ -375,7 +594,7 @@ sys_chdir(void)
   struct inode *ip;
   struct proc *curproc = myproc();
   
-  begin_op();
+  begin_op(OP_IPUT);
   if(argstr(0, &path) < 0 || (ip = namei(path)) == 0){
     end_op();
     return -1;
@@ -393,6 +612,43 @@ sys_chdir(void)
   return 0;
 }
 
+// Mount a new, empty tmpfs on directory path.
+int
+sys_mount(void)
+{
+  char *path;
+  struct inode *ip, *root;
+
+  begin_op(OP_IPUT);
+  if(argstr(0, &path) < 0 || (ip = namei(path)) == 0){
+    end_op();
+    return -1;
+  }
+  ilock(ip);
+  if(ip->type != T_DIR){
+    iunlockput(ip);
+    end_op();
+    return -1;
+  }
+  iunlock(ip);
+  if((root = tmpmount()) == 0){
+    iput(ip);
+    end_op();
+    return -1;
+  }
+  if(mount(ip, root) < 0){
+    ilock(root);
+    root->nlink = 0;  // free it
+    iupdate(root);
+    iunlockput(root);
+    iput(ip);
+    end_op();
+    return -1;
+  }
+  end_op();
+  return 0;
+}
+
 int
 sys_exec(void)
 {
@@ -442,3 +698,174 @@ sys_pipe(void)
   fd[1] = fd1;
   return 0;
 }
+
+// Set the buffer size of the pipe fd refers to,
+// or with n 0 just return it.
+int
+sys_pipesize(void)
+{
+  struct file *f;
+  int n;
+
+  if(argfd(0, 0, &f) < 0 || argint(1, &n) < 0)
+    return -1;
+  if(f->type != FD_PIPE)
+    return -1;
+  return pipesize(f->pipe, n);
+}
+
+// Move n bytes from fd in to fd out, one of them a pipe.
+int
+sys_splice(void)
+{
+  struct file *in, *out;
+  int n;
+
+  if(argfd(0, 0, &in) < 0 || argfd(1, 0, &out) < 0 || argint(2, &n) < 0)
+    return -1;
+  return filesplice(in, out, n);
+}
+
+// Copy n bytes from pipe in to pipe out, leaving them in in.
+int
+sys_tee(void)
+{
+  struct file *in, *out;
+  int n;
+
+  if(argfd(0, 0, &in) < 0 || argfd(1, 0, &out) < 0 || argint(2, &n) < 0)
+    return -1;
+  return filetee(in, out, n);
+}
+
+// Copy n bytes from file in to fd out.
+int
+sys_sendfile(void)
+{
+  struct file *out, *in;
+  int n;
+
+  if(argfd(0, 0, &out) < 0 || argfd(1, 0, &in) < 0 || argint(2, &n) < 0)
+    return -1;
+  return filesendfile(out, in, n);
+}
+
+//PAGEBREAK!
+// Register the struct ring at addr for batched I/O,
+// or with addr 0 stop using one.
+int
+sys_ringsetup(void)
+{
+  char *r;
+  int addr;
+
+  if(argint(0, &addr) < 0)
+    return -1;
+  if(addr != 0 && argptr(0, &r, sizeof(struct ring)) < 0)
+    return -1;
+  myproc()->ring = addr;
+  return 0;
+}
+
+// Perform the ring's queued operations.
+int
+sys_ringenter(void)
+{
+  if(myproc()->ring == 0)
+    return -1;
+  return ringdrain(RINGSIZE, 0);
+}
+
+// Whether e can be performed at a clock tick: a read or
+// write that would sleep until some process, perhaps this
+// one, reads or writes a pipe or the console cannot.
+static int
+ringready(struct ringsqe *e)
+{
+  struct file *f;
+
+  if(e->op != RING_READ && e->op != RING_WRITE)
+    return 1;
+  if(e->fd < 0 || e->fd >= NOFILE || (f = myproc()->ofile[e->fd]) == 0)
+    return 1;  // fails at once
+  if(e->op == RING_READ ? !f->readable : !f->writable)
+    return 1;
+  if(e->op == RING_READ)
+    return (filepoll(f, 0) & (POLLIN|POLLHUP)) != 0;
+  return (filepoll(f, 0) & (POLLOUT|POLLERR)) != 0;
+}
+
+// Perform e.  With nonblock, write to a pipe only what
+// fits, as for an O_NONBLOCK pipe.
+static int
+ringop(struct ringsqe *e, int nonblock)
+{
+  struct proc *curproc = myproc();
+  struct file *f;
+  char *path;
+
+  if(e->op == RING_NOP)
+    return 0;
+  if(e->op == RING_OPEN){
+    if(fetchstr(e->addr, &path) < 0)
+      return -1;
+    return openpath(path, e->n);
+  }
+  if(e->fd < 0 || e->fd >= NOFILE || (f = curproc->ofile[e->fd]) == 0)
+    return -1;
+  switch(e->op){
+  case RING_READ:
+    if(!uvalid(e->addr, e->n))
+      return -1;
+    return fileread(f, (char*)e->addr, e->n);
+  case RING_WRITE:
+    if(!uvalid(e->addr, e->n))
+      return -1;
+    if(nonblock && f->type == FD_PIPE && f->writable)
+      return pipewrite(f->pipe, (char*)e->addr, e->n, 1);
+    return filewrite(f, (char*)e->addr, e->n);
+  case RING_CLOSE:
+    curproc->ofile[e->fd] = 0;
+    fileclose(f);
+    return 0;
+  }
+  return -1;
+}
+
+// Perform up to max queued operations from the current
+// process's ring, in order, while there is room for
+// completions.  With nonblock, as at a clock tick, stop at
+// an operation that would sleep until something else runs
+// and leave it queued.  Return how many were done.  The ring is in user memory,
+// which the program may change at any time, so copy each
+// entry before using it.
+int
+ringdrain(int max, int nonblock)
+{
+  struct proc *curproc = myproc();
+  struct ring *r;
+  struct ringsqe e;
+  struct ringcqe *c;
+  int n;
+
+  if(!uvalid(curproc->ring, sizeof(*r))){
+    curproc->ring = 0;
+    return -1;
+  }
+  r = (struct ring*)curproc->ring;
+  for(n = 0; n < max && r->sqhead != r->sqtail && r->cqtail - r->cqhead < RINGSIZE; n++){
+    __sync_synchronize();
+    e = r->sq[r->sqhead % RINGSIZE];
+    if(nonblock && !ringready(&e))
+      break;
+    r->sqhead++;
+    c = &r->cq[r->cqtail % RINGSIZE];
+    c->res = ringop(&e, nonblock);
+    c->data = e.data;
+    __sync_synchronize();
+    r->cqtail++;
+    if(curproc->killed || curproc->ring != (uint)r)
+      break;
+  }
+  return n;
+}
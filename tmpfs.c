@@ -0,0 +1,243 @@
+// A file system in memory, for scratch files.
+//
+// tmpfs inodes live in the same inode cache as disk inodes,
+// on device TMPDEV, and fs.c hands the parts that would touch
+// the disk to the functions here: ialloc(), ilock() and
+// iupdate() keep each inode's fields in a struct tmpnode
+// instead of a dinode, and readi(), writei() and itrunc() keep
+// its data in kalloc()'d pages instead of disk blocks.  Nothing
+// goes through the buffer cache or the log, and nothing
+// survives a reboot.
+//
+// A file's pages are listed in an index page, so a file can
+// grow to PGSIZE/sizeof(char*) pages.  All tmpfs file systems
+// together may use at most TMPPAGES pages.  Directories are
+// flat lists of dirents, as on the original xv6 disk.
+//
+// The mount table in fs.c makes a tmpfs root directory appear
+// in place of a disk directory; see mount().
+//
+// A node's fields and pages are protected by the lock of its
+// in-memory inode.  tmp.lock protects which nodes are free, and
+// the page count.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "stat.h"
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+
+#define NPAGEPTR (PGSIZE / sizeof(char*))  // pages in an index page
+#define MAXTMPFILE (NPAGEPTR * PGSIZE)    // bytes in a file
+
+struct tmpnode {
+  short type;    // 0 if free
+  short major;
+  short minor;
+  short nlink;
+  uint size;
+  char **page;   // index page, or 0 if there is no data
+};
+
+static struct {
+  struct spinlock lock;
+  struct tmpnode node[NTMPINODE];
+  int npage;     // pages in use, counting index pages
+} tmp;
+
+void
+tmpinit(void)
+{
+  initlock(&tmp.lock, "tmpfs");
+}
+
+// Allocate a node of type type.
+// Return its inode number, or 0 if there are none left.
+uint
+tmpialloc(short type)
+{
+  struct tmpnode *n;
+
+  acquire(&tmp.lock);
+  for(n = &tmp.node[1]; n < &tmp.node[NTMPINODE]; n++){
+    if(n->type == 0){
+      memset(n, 0, sizeof(*n));
+      n->type = type;
+      release(&tmp.lock);
+      return n - tmp.node;
+    }
+  }
+  release(&tmp.lock);
+  return 0;
+}
+
+// Fill in ip's fields from its node, as ilock() does
+// from the disk.
+void
+tmpiload(struct inode *ip)
+{
+  struct tmpnode *n;
+
+  n = &tmp.node[ip->inum];
+  ip->type = n->type;
+  ip->major = n->major;
+  ip->minor = n->minor;
+  ip->nlink = n->nlink;
+  ip->size = n->size;
+  ip->flags = 0;
+}
+
+// Copy ip's fields to its node, as iupdate() does to the
+// disk.  Setting the type to 0 frees the node.
+void
+tmpiupdate(struct inode *ip)
+{
+  struct tmpnode *n;
+
+  n = &tmp.node[ip->inum];
+  acquire(&tmp.lock);
+  n->type = ip->type;
+  n->major = ip->major;
+  n->minor = ip->minor;
+  n->nlink = ip->nlink;
+  n->size = ip->size;
+  release(&tmp.lock);
+}
+
+// Take a zeroed page from the tmpfs allowance.
+static char*
+tmppage(void)
+{
+  char *p;
+
+  acquire(&tmp.lock);
+  if(tmp.npage >= TMPPAGES){
+    release(&tmp.lock);
+    return 0;
+  }
+  tmp.npage++;
+  release(&tmp.lock);
+  if((p = kalloc()) == 0){
+    acquire(&tmp.lock);
+    tmp.npage--;
+    release(&tmp.lock);
+    return 0;
+  }
+  memset(p, 0, PGSIZE);
+  return p;
+}
+
+// Free n's pages from page number from on, and its index
+// page too if from is 0.
+static void
+tmpfree(struct tmpnode *n, uint from)
+{
+  int i, freed;
+
+  if(n->page == 0)
+    return;
+  freed = 0;
+  for(i = from; i < NPAGEPTR; i++){
+    if(n->page[i]){
+      kfree(n->page[i]);
+      n->page[i] = 0;
+      freed++;
+    }
+  }
+  if(from == 0){
+    kfree((char*)n->page);
+    n->page = 0;
+    freed++;
+  }
+  acquire(&tmp.lock);
+  tmp.npage -= freed;
+  release(&tmp.lock);
+}
+
+// Free all of ip's pages.
+void
+tmptrunc(struct inode *ip)
+{
+  tmpfree(&tmp.node[ip->inum], 0);
+}
+
+// Read n bytes at off, which readi() has checked
+// against the size.
+int
+tmpread(struct inode *ip, char *dst, uint off, uint n)
+{
+  struct tmpnode *t;
+  uint tot, m;
+
+  t = &tmp.node[ip->inum];
+  for(tot = 0; tot < n; tot += m, off += m, dst += m){
+    m = min(n - tot, PGSIZE - off%PGSIZE);
+    if(t->page && t->page[off/PGSIZE])
+      memmove(dst, t->page[off/PGSIZE] + off%PGSIZE, m);
+    else
+      memset(dst, 0, m);
+  }
+  return n;
+}
+
+// Write n bytes at off, which writei() has checked is not
+// past the end of the file.  Either all of the pages the
+// write needs can be had, or it writes nothing and fails.
+int
+tmpwrite(struct inode *ip, char *src, uint off, uint n)
+{
+  struct tmpnode *t;
+  uint tot, m, pn;
+
+  if(off + n > MAXTMPFILE)
+    return -1;
+  t = &tmp.node[ip->inum];
+  if(n > 0 && t->page == 0 && (t->page = (char**)tmppage()) == 0)
+    return -1;
+  for(pn = off/PGSIZE; pn*PGSIZE < off + n; pn++){
+    if(t->page[pn] == 0 && (t->page[pn] = tmppage()) == 0){
+      // Give back the pages taken so far, which are
+      // all past the end of the file.
+      tmpfree(t, (ip->size + PGSIZE-1) / PGSIZE);
+      return -1;
+    }
+  }
+
+  for(tot = 0; tot < n; tot += m, off += m, src += m){
+    m = min(n - tot, PGSIZE - off%PGSIZE);
+    memmove(t->page[off/PGSIZE] + off%PGSIZE, src, m);
+  }
+  if(n > 0 && off > ip->size){
+    ip->size = off;
+    iupdate(ip);
+  }
+  return n;
+}
+
+// Make a new tmpfs: return its root directory,
+// unlocked, or 0 if there are no nodes or pages left.
+struct inode*
+tmpmount(void)
+{
+  struct inode *ip;
+
+  if((ip = ialloc(TMPDEV, T_DIR)) == 0)
+    return 0;
+  ilock(ip);
+  ip->nlink = 1;
+  iupdate(ip);
+  if(dirlink(ip, ".", ip->inum) < 0 || dirlink(ip, "..", ip->inum) < 0){
+    ip->nlink = 0;  // free it
+    iupdate(ip);
+    iunlockput(ip);
+    return 0;
+  }
+  iunlock(ip);
+  return ip;
+}
@@ -13,6 +13,7 @@ struct gatedesc idt[256];
 extern uint vectors[];  // in vectors.S: array of 256 entry pointers
 struct spinlock tickslock;
 uint ticks;
+int nosysenter;  // some CPU lacks sysenter
 
 void
 tvinit(void)
@@ -32,6 +33,25 @@ idtinit(void)
   lidt(idt, sizeof(idt));
 }
 
+// Have this CPU's sysenter enter the kernel at sysentry.
+// switchuvm() sets the stack, which changes per process.
+// sysexit returns to SEG_UCODE and SEG_UDATA, the two
+// segments after SEG_KCODE.  A CPU without sysenter sets
+// nosysenter instead, and programs keep to int $T_SYSCALL
+// (see vdsoinit() and usys.S).
+void
+sysenterinit(void)
+{
+  extern char sysentry[];
+
+  if((cpuidedx(1) & CPUID_SEP) == 0){
+    nosysenter = 1;
+    return;
+  }
+  wrmsr(MSR_SYSENTER_CS, SEG_KCODE<<3, 0);
+  wrmsr(MSR_SYSENTER_EIP, (uint)sysentry, 0);
+}
+
 //PAGEBREAK: 41
 void
 trap(struct trapframe *tf)
@@ -51,6 +71,7 @@ trap(struct trapframe *tf)
     if(cpuid() == 0){
       acquire(&tickslock);
       ticks++;
+      vdsotick();
       wakeup(&ticks);
       release(&tickslock);
     }
@@ -106,6 +127,17 @@ trap(struct trapframe *tf)
      tf->trapno == T_IRQ0+IRQ_TIMER)
     yield();
 
+  // A tick that interrupts a program with a ring performs a
+  // few of its queued operations, so that it need not call
+  // ringenter().  They may copy a lot and wait for the disk,
+  // so run them with interrupts on, as a system call would,
+  // but none that would wait for the program itself.
+  if(myproc() && myproc()->ring && myproc()->state == RUNNING &&
+     tf->trapno == T_IRQ0+IRQ_TIMER && (tf->cs&3) == DPL_USER){
+    sti();
+    ringdrain(RINGTICK, 1);
+  }
+
   // Check if the process has been killed since we yielded
   if(myproc() && myproc()->killed && (tf->cs&3) == DPL_USER)
     exit();
@@ -3,6 +3,7 @@
 #include "fcntl.h"
 #include "user.h"
 #include "x86.h"
+#include "vdso.h"
 
 // MODIFIED CODE ---------------------------------------------------------->
 // locking functions- not system calls, but user defined functions that are required to protect state while using threads
@@ -161,3 +162,74 @@ memmove(void *vdst, const void *vsrc, int n)
     *dst++ = *src++;
   return vdst;
 }
+
+int memcmp(const void *v1, const void *v2, uint n)
+{
+  const uchar *s1, *s2;
+
+  s1 = v1;
+  s2 = v2;
+  while (n-- > 0)
+  {
+    if (*s1 != *s2)
+      return *s1 - *s2;
+    s1++, s2++;
+  }
+  return 0;
+}
+
+// The log commits a file's data and its size together,
+// so there is nothing less to wait for than fsync().
+int fdatasync(int fd)
+{
+  return fsync(fd);
+}
+
+// Read from the vdso page, without entering the kernel.
+// %gs selects this thread's slot in it.
+int vgetpid(void)
+{
+  int pid;
+
+  asm volatile("movl %%gs:0, %0" : "=r"(pid));
+  return pid;
+}
+
+int gettid(void)
+{
+  int tid;
+
+  asm volatile("movl %%gs:4, %0" : "=r"(tid));
+  return tid;
+}
+
+int getncpu(void)
+{
+  return ((struct vdso *)VDSO)->ncpu;
+}
+
+int vuptime(void)
+{
+  return ((volatile struct vdso *)VDSO)->ticks;
+}
+
+// Ticks since boot, and in *cycles the TSC cycles since the
+// last tick, read consistently.  *cyclespertick is 0 until
+// the kernel has calibrated the TSC.
+uint vclock(uint *cycles, uint *cyclespertick)
+{
+  volatile struct vdso *v = (volatile struct vdso *)VDSO;
+  uint seq, t;
+
+  do
+  {
+    while ((seq = v->seq) & 1)
+      ;
+    __sync_synchronize();
+    t = v->ticks;
+    *cycles = rdtsc() - v->ticktsc;
+    *cyclespertick = v->tscpertick;
+    __sync_synchronize();
+  } while (v->seq != seq);
+  return t;
+}
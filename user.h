@@ -1,5 +1,8 @@
 struct stat;
 struct rtcdate;
+struct pollfd;
+struct ring;
+struct iovec;
 
 // system calls
 int fork(void);
@@ -31,11 +34,27 @@ int requestresource(int);
 int writeresource(int, void *, int, int);
 int readresource(int, int, int, void *);
 int releaseresource(int);
+int fallocate(int, int);
+int pipesize(int, int);
+int splice(int, int, int);
+int tee(int, int, int);
+int sendfile(int, int, int);
+int poll(struct pollfd*, int, int);
+int fcntl(int, int, int);
+int ringsetup(struct ring*);
+int ringenter(void);
+int pread(int, void*, int, int);
+int pwrite(int, const void*, int, int);
+int readv(int, const struct iovec*, int);
+int writev(int, const struct iovec*, int);
+int fsync(int);
+int mount(char*);
 // MODIFIED CODE ---------------------------------------------------------->
 // ulib.c
 int stat(const char *, struct stat *);
 char *strcpy(char *, const char *);
 void *memmove(void *, const void *, int);
+int memcmp(const void *, const void *, uint);
 char *strchr(const char *, char c);
 int strcmp(const char *, const char *);
 void printf(int, const char *, ...);
@@ -45,6 +64,12 @@ void *memset(void *, int, uint);
 void *malloc(uint);
 void free(void *);
 int atoi(const char *);
+int vgetpid(void);
+int gettid(void);
+int getncpu(void);
+int vuptime(void);
+uint vclock(uint *, uint *);
+int fdatasync(int);
 
 // MODIFIED CODE ---------------------------------------------------------->
 // Thread library- function definitions
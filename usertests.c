@@ -4,6 +4,7 @@
 #include "user.h"
 #include "fs.h"
 #include "fcntl.h"
+#include "ring.h"
 #include "syscall.h"
 #include "traps.h"
 #include "memlayout.h"
@@ -184,6 +185,10 @@ writetest(void)
   printf(stdout, "small file test ok\n");
 }
 
+// 512-byte writes; with BSIZE 512 that reaches the doubly
+// indirect block of a block-mapped file (mkfs -b).
+#define BIGFILE (NDIRECT + NINDIRECT + 64)
+
 void
 writetest1(void)
 {
@@ -197,7 +202,7 @@ writetest1(void)
     exit();
   }
 
-  for(i = 0; i < MAXFILE; i++){
+  for(i = 0; i < BIGFILE; i++){
     ((int*)buf)[0] = i;
     if(write(fd, buf, 512) != 512){
       printf(stdout, "error: write big file failed\n", i);
@@ -217,7 +222,7 @@ writetest1(void)
   for(;;){
     i = read(fd, buf, 512);
     if(i == 0){
-      if(n == MAXFILE - 1){
+      if(n != BIGFILE){
         printf(stdout, "read only %d blocks from big", n);
         exit();
       }
@@ -241,6 +246,92 @@ writetest1(void)
   printf(stdout, "big files ok\n");
 }
 
+// Small files live in the inode; growing one must carry its
+// data along to a block.
+void
+inlinetest(void)
+{
+  int fd, i;
+  char b[100];
+
+  printf(stdout, "inline test\n");
+  fd = open("inl", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf(stdout, "create inl failed\n");
+    exit();
+  }
+  for(i = 0; i < sizeof(b); i++)
+    b[i] = 'a' + i % 26;
+  for(i = 0; i < sizeof(b); i += 10){
+    if(write(fd, b + i, 10) != 10){
+      printf(stdout, "write inl failed\n");
+      exit();
+    }
+  }
+  close(fd);
+  memset(b, 0, sizeof(b));
+  fd = open("inl", O_RDONLY);
+  if(read(fd, b, sizeof(b)) != sizeof(b)){
+    printf(stdout, "read inl failed\n");
+    exit();
+  }
+  close(fd);
+  for(i = 0; i < sizeof(b); i++){
+    if(b[i] != 'a' + i % 26){
+      printf(stdout, "inl has wrong data\n");
+      exit();
+    }
+  }
+  unlink("inl");
+  printf(stdout, "inline ok\n");
+}
+
+// Space reserved with fallocate() is used by later writes,
+// and does not show up in the file's size.
+void
+fallocatetest(void)
+{
+  int fd, i;
+  struct stat st;
+
+  printf(stdout, "fallocate test\n");
+  fd = open("falloc", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf(stdout, "create falloc failed\n");
+    exit();
+  }
+  if(fallocate(fd, 20*BSIZE) != 0){
+    printf(stdout, "fallocate failed\n");
+    exit();
+  }
+  if(fstat(fd, &st) < 0 || st.size != 0){
+    printf(stdout, "fallocate changed size\n");
+    exit();
+  }
+  for(i = 0; i < 25; i++){
+    memset(buf, i, BSIZE);
+    if(write(fd, buf, BSIZE) != BSIZE){
+      printf(stdout, "write falloc failed\n");
+      exit();
+    }
+  }
+  close(fd);
+  fd = open("falloc", O_RDONLY);
+  for(i = 0; i < 25; i++){
+    if(read(fd, buf, BSIZE) != BSIZE || buf[0] != i || buf[BSIZE-1] != i){
+      printf(stdout, "read falloc failed\n");
+      exit();
+    }
+  }
+  if(fallocate(fd, BSIZE) >= 0){
+    printf(stdout, "fallocate on read-only fd succeeded!\n");
+    exit();
+  }
+  close(fd);
+  unlink("falloc");
+  printf(stdout, "fallocate ok\n");
+}
+
 void
 createtest(void)
 {
@@ -354,6 +445,440 @@ pipe1(void)
   printf(1, "pipe1 ok\n");
 }
 
+// resizing a pipe keeps its data, and a bigger pipe
+// takes more without a reader.
+void
+pipesizetest(void)
+{
+  int fds[2], i, n, seq;
+
+  printf(1, "pipesize test\n");
+  if(pipe(fds) != 0){
+    printf(1, "pipe() failed\n");
+    exit();
+  }
+  seq = 0;
+  for(n = 0; n < 2; n++){
+    for(i = 0; i < 3000; i++)
+      buf[i] = seq++;
+    if(write(fds[1], buf, 3000) != 3000){
+      printf(1, "pipesize: write failed\n");
+      exit();
+    }
+  }
+  if(pipesize(fds[1], 1) != -1){
+    printf(1, "pipesize: shrank below its contents\n");
+    exit();
+  }
+  if(pipesize(fds[0], 65536) != 65536 || pipesize(fds[1], 0) != 65536){
+    printf(1, "pipesize: resize failed\n");
+    exit();
+  }
+  for(n = 0; n < 7; n++){
+    for(i = 0; i < 8000; i++)
+      buf[i] = seq++;
+    if(write(fds[1], buf, 8000) != 8000){
+      printf(1, "pipesize: write failed\n");
+      exit();
+    }
+  }
+  close(fds[1]);
+  seq = 0;
+  while((n = read(fds[0], buf, sizeof(buf))) > 0){
+    for(i = 0; i < n; i++){
+      if((buf[i] & 0xff) != (seq++ & 0xff)){
+        printf(1, "pipesize: wrong data\n");
+        exit();
+      }
+    }
+  }
+  if(seq != 2*3000 + 7*8000){
+    printf(1, "pipesize: read %d bytes\n", seq);
+    exit();
+  }
+  close(fds[0]);
+  printf(1, "pipesize ok\n");
+}
+
+// file -> pipe -> (tee) -> file without read or write.
+void
+splicetest(void)
+{
+  int fd, p[2], q[2], i, n;
+
+  printf(1, "splice test\n");
+  unlink("splice0");
+  unlink("splice1");
+  fd = open("splice0", O_CREATE|O_RDWR);
+  for(i = 0; i < 5000; i++)
+    buf[i] = i % 251;
+  if(fd < 0 || write(fd, buf, 5000) != 5000){
+    printf(1, "splice: create failed\n");
+    exit();
+  }
+  close(fd);
+  if(pipe(p) != 0 || pipe(q) != 0){
+    printf(1, "pipe() failed\n");
+    exit();
+  }
+  fd = open("splice0", O_RDONLY);
+  if(sendfile(p[1], fd, 8000) != 5000 || splice(fd, p[1], 100) != 0){
+    printf(1, "splice: file to pipe failed\n");
+    exit();
+  }
+  close(fd);
+  if(tee(p[0], q[1], 8000) != 5000 || splice(p[1], q[0], 10) != -1){
+    printf(1, "splice: tee failed\n");
+    exit();
+  }
+  fd = open("splice1", O_CREATE|O_RDWR);
+  if(splice(p[0], fd, 8000) != 5000){
+    printf(1, "splice: pipe to file failed\n");
+    exit();
+  }
+  close(fd);
+  fd = open("splice1", O_RDONLY);
+  n = read(fd, buf, sizeof(buf));
+  close(fd);
+  if(n != 5000){
+    printf(1, "splice: wrote %d bytes\n", n);
+    exit();
+  }
+  for(i = 0; i < 5000; i++){
+    if((buf[i] & 0xff) != i % 251){
+      printf(1, "splice: wrong data\n");
+      exit();
+    }
+  }
+  if(read(q[0], buf, sizeof(buf)) != 5000 || (buf[4999] & 0xff) != 4999 % 251){
+    printf(1, "splice: tee lost data\n");
+    exit();
+  }
+  close(p[0]);
+  close(p[1]);
+  close(q[0]);
+  close(q[1]);
+  unlink("splice0");
+  unlink("splice1");
+  printf(1, "splice ok\n");
+}
+
+// O_NONBLOCK pipes, poll() waking for the one of two
+// pipes that gets data, and poll() on a regular file.
+void
+polltest(void)
+{
+  int a[2], b[2], pid;
+  struct pollfd pfd[2];
+
+  printf(1, "poll test\n");
+  if(pipe(a) != 0 || pipe(b) != 0){
+    printf(1, "pipe() failed\n");
+    exit();
+  }
+  if(fcntl(a[0], F_SETFL, O_NONBLOCK) != 0 || fcntl(a[1], F_SETFL, O_NONBLOCK) != 0 ||
+     fcntl(a[0], F_GETFL, 0) != (O_RDONLY|O_NONBLOCK)){
+    printf(1, "poll: fcntl failed\n");
+    exit();
+  }
+  if(read(a[0], buf, 1) != -1){
+    printf(1, "poll: read of empty pipe did not fail\n");
+    exit();
+  }
+  if(write(a[1], buf, sizeof(buf)) != sizeof(buf) || write(a[1], buf, 65536) != pipesize(a[1], 0) - sizeof(buf)){
+    printf(1, "poll: write to full pipe did not stop\n");
+    exit();
+  }
+  pfd[0].fd = a[1];
+  pfd[0].events = POLLOUT;
+  pfd[1].fd = b[0];
+  pfd[1].events = POLLIN;
+  if(poll(pfd, 2, 0) != 0 || poll(pfd, 2, 2) != 0){
+    printf(1, "poll: nothing should be ready\n");
+    exit();
+  }
+
+  pid = fork();
+  if(pid == 0){
+    sleep(5);
+    write(b[1], "x", 1);
+    exit();
+  }
+  if(poll(pfd, 2, -1) != 1 || pfd[0].revents != 0 || pfd[1].revents != POLLIN){
+    printf(1, "poll: wrong events\n");
+    exit();
+  }
+  wait();
+  close(b[1]);
+  if(read(b[0], buf, 2) != 1 || poll(pfd + 1, 1, -1) != 1 || pfd[1].revents != POLLHUP){
+    printf(1, "poll: no hangup\n");
+    exit();
+  }
+  // A regular file is always ready, and is not on any wait queue.
+  pfd[0].fd = open("pollfile", O_CREATE|O_RDWR);
+  pfd[0].events = POLLIN|POLLOUT;
+  if(pfd[0].fd < 0 || poll(pfd, 2, -1) != 2 || pfd[0].revents != (POLLIN|POLLOUT)){
+    printf(1, "poll: regular file not ready\n");
+    exit();
+  }
+  close(pfd[0].fd);
+  unlink("pollfile");
+  close(a[0]);
+  close(a[1]);
+  close(b[0]);
+  printf(1, "poll ok\n");
+}
+
+struct ring ioring;
+
+static void
+ringsubmit(int op, int fd, void *addr, int n)
+{
+  struct ringsqe *e;
+
+  e = &ioring.sq[ioring.sqtail % RINGSIZE];
+  e->op = op;
+  e->fd = fd;
+  e->addr = (uint)addr;
+  e->n = n;
+  e->data = ioring.sqtail;
+  __sync_synchronize();
+  ioring.sqtail++;
+}
+
+// open, write, close and read back a file through the ring,
+// one ringenter() per batch, and a pipe read that waits.  A clock tick may perform some
+// of a batch first, so look at cqtail, not what ringenter()
+// returns.
+void
+ringtest(void)
+{
+  struct ringcqe *c;
+  int i, p[2], res[4];
+  uint t;
+
+  printf(1, "ring test\n");
+  unlink("ringfile");
+  memset(&ioring, 0, sizeof(ioring));
+  if(ringsetup(&ioring) != 0){
+    printf(1, "ring: setup failed\n");
+    exit();
+  }
+  for(i = 0; i < 100; i++)
+    buf[i] = 'a' + i % 26;
+  // Fds are small and allocated lowest first, so the
+  // program can tell which fd the open will return.
+  i = dup(0);
+  close(i);
+  ringsubmit(RING_OPEN, 0, "ringfile", O_CREATE|O_RDWR);
+  ringsubmit(RING_WRITE, i, buf, 100);
+  ringsubmit(RING_CLOSE, i, 0, 0);
+  ringsubmit(RING_OPEN, 0, "ringfile", O_RDONLY);
+  if(ringenter() < 0 || ioring.cqtail != 4){
+    printf(1, "ring: enter failed\n");
+    exit();
+  }
+  for(; ioring.cqhead != ioring.cqtail; ioring.cqhead++){
+    c = &ioring.cq[ioring.cqhead % RINGSIZE];
+    res[c->data] = c->res;
+  }
+  if(res[0] != i || res[1] != 100 || res[2] != 0 || res[3] != i){
+    printf(1, "ring: wrong results %d %d %d %d\n", res[0], res[1], res[2], res[3]);
+    exit();
+  }
+  memset(buf, 0, 100);
+  ringsubmit(RING_READ, i, buf, 200);
+  ringsubmit(RING_CLOSE, i, 0, 0);
+  ringsubmit(RING_READ, i, buf, 10);
+  if(ringenter() < 0 || ioring.cqtail != 7 || ioring.cq[4].res != 100 || ioring.cq[5].res != 0 ||
+     ioring.cq[6].res != -1 || buf[99] != 'a' + 99 % 26){
+    printf(1, "ring: read back failed\n");
+    exit();
+  }
+  // Clock ticks leave a read of an empty pipe queued
+  // rather than sleep in it; this program fills the pipe.
+  if(pipe(p) != 0){
+    printf(1, "pipe() failed\n");
+    exit();
+  }
+  ringsubmit(RING_READ, p[0], buf, 10);
+  for(t = vuptime(); vuptime() - t < 3; )
+    ;
+  if(ioring.sqhead != 7 || ioring.cqtail != 7 || write(p[1], "x", 1) != 1 ||
+     ringenter() < 0 || ioring.cqtail != 8 || ioring.cq[7].res != 1){
+    printf(1, "ring: pipe read not left queued\n");
+    exit();
+  }
+  close(p[0]);
+  close(p[1]);
+  ringsetup(0);
+  unlink("ringfile");
+  printf(1, "ring ok\n");
+}
+
+// positional and vectored i/o: pread/pwrite do not move
+// the offset, readv/writev fill and drain buffers in order.
+void
+preadtest(void)
+{
+  struct iovec iov[3];
+  char a[5], b[10];
+  int fd, i;
+
+  printf(1, "pread test\n");
+  unlink("preadfile");
+  fd = open("preadfile", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf(1, "pread: create failed\n");
+    exit();
+  }
+  for(i = 0; i < 26; i++)
+    buf[i] = 'a' + i;
+  iov[0].base = buf;
+  iov[0].len = 5;
+  iov[1].base = buf + 5;
+  iov[1].len = 0;
+  iov[2].base = buf + 5;
+  iov[2].len = 21;
+  if(writev(fd, iov, 3) != 26){
+    printf(1, "pread: writev failed\n");
+    exit();
+  }
+  if(pwrite(fd, "XY", 2, 10) != 2 || pread(fd, b, 4, 9) != 4 || memcmp(b, "jXYm", 4) != 0){
+    printf(1, "pread: pwrite/pread failed\n");
+    exit();
+  }
+  if(pread(fd, b, 10, 20) != 6 || pread(fd, b, 1, -1) != -1){
+    printf(1, "pread: bad pread at end\n");
+    exit();
+  }
+  // The offset is still 26, after the writev.
+  if(read(fd, b, 1) != 0 || write(fd, "!", 1) != 1){
+    printf(1, "pread: offset moved\n");
+    exit();
+  }
+  close(fd);
+
+  fd = open("preadfile", O_RDONLY);
+  iov[0].base = a;
+  iov[0].len = sizeof(a);
+  iov[1].base = b;
+  iov[1].len = sizeof(b);
+  iov[2].base = buf;
+  iov[2].len = 100;
+  if(readv(fd, iov, 3) != 27 || memcmp(a, "abcde", 5) != 0 || memcmp(b, "fghijXYmno", 10) != 0 ||
+     buf[11] != '!' || pwrite(fd, "x", 1, 0) != -1){
+    printf(1, "pread: readv failed\n");
+    exit();
+  }
+  close(fd);
+  unlink("preadfile");
+  printf(1, "pread ok\n");
+}
+
+// fsync() works on files, not pipes; durability itself
+// needs a crash to check.
+void
+fsynctest(void)
+{
+  int fd, fds[2];
+
+  printf(1, "fsync test\n");
+  fd = open("fsyncfile", O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, "hello", 5) != 5 || fsync(fd) != 0 || fdatasync(fd) != 0){
+    printf(1, "fsync: failed on a file\n");
+    exit();
+  }
+  close(fd);
+  if(pipe(fds) != 0 || fsync(fds[0]) != -1 || fsync(fd) != -1){
+    printf(1, "fsync: worked on a pipe or closed fd\n");
+    exit();
+  }
+  close(fds[0]);
+  close(fds[1]);
+  unlink("fsyncfile");
+  printf(1, "fsync ok\n");
+}
+
+// /tmp, which init mounts at boot, is a separate file
+// system: files there read back, ".." leads out of it,
+// and it cannot be unlinked or linked across.
+void
+tmpfstest(void)
+{
+  struct stat st, rst;
+  char buf[16];
+  int fd, i;
+
+  printf(1, "tmpfs test\n");
+  if(stat("/", &rst) < 0 || stat("/tmp", &st) < 0 || st.dev == rst.dev){
+    printf(1, "tmpfs: /tmp not mounted\n");
+    exit();
+  }
+  fd = open("/tmp/x", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf(1, "tmpfs: create failed\n");
+    exit();
+  }
+  for(i = 0; i < 1000; i++)
+    if(write(fd, "0123456789", 10) != 10){
+      printf(1, "tmpfs: write failed\n");
+      exit();
+    }
+  if(pread(fd, buf, 10, 9990) != 10 || memcmp(buf, "0123456789", 10) != 0 ||
+     fstat(fd, &st) < 0 || st.size != 10000 || st.dev == rst.dev){
+    printf(1, "tmpfs: read back failed\n");
+    exit();
+  }
+  close(fd);
+  if(link("/tmp/x", "/tmpxlink") != -1 || unlink("/tmp") != -1 || mount("/tmp") != -1){
+    printf(1, "tmpfs: link, unlink or mount worked\n");
+    exit();
+  }
+  if(mkdir("/tmp/d") < 0 || chdir("/tmp/d") < 0 || chdir("../..") < 0 ||
+     stat(".", &st) < 0 || st.dev != rst.dev || st.ino != rst.ino){
+    printf(1, "tmpfs: .. does not leave /tmp\n");
+    exit();
+  }
+  if(unlink("/tmp/d") < 0 || unlink("/tmp/x") < 0){
+    printf(1, "tmpfs: unlink failed\n");
+    exit();
+  }
+  printf(1, "tmpfs ok\n");
+}
+
+// the vdso page agrees with the system calls, in a
+// child as well, whose slot is a different one.
+void
+vdsotest(void)
+{
+  uint t, cycles, cpt;
+  int pid;
+
+  printf(1, "vdso test\n");
+  if(vgetpid() != getpid() || gettid() != 0 || getncpu() <= 0){
+    printf(1, "vdso: pid %d tid %d ncpu %d\n", vgetpid(), gettid(), getncpu());
+    exit();
+  }
+  t = vclock(&cycles, &cpt);
+  if(t > uptime() || uptime() - t > 1){
+    printf(1, "vdso: ticks %d uptime %d\n", t, uptime());
+    exit();
+  }
+  pid = fork();
+  if(pid == 0){
+    if(vgetpid() != getpid())
+      printf(1, "vdso: child pid %d, not %d\n", vgetpid(), getpid());
+    exit();
+  }
+  wait();
+  if(vgetpid() != getpid()){
+    printf(1, "vdso: pid changed\n");
+    exit();
+  }
+  printf(1, "vdso ok\n");
+}
+
 // meant to be run w/ at most two CPUs
 void
 preempt(void)
@@ -1144,6 +1669,64 @@ bigwrite(void)
   printf(1, "bigwrite ok\n");
 }
 
+// writes long enough to keep new blocks out of the log:
+// one reusing blocks just freed, and one over existing
+// blocks, which go through the log.
+#define BULK (20*BSIZE)
+
+void
+bulkwrite(void)
+{
+  char *p;
+  int fd, i, j, off;
+
+  printf(1, "bulkwrite test\n");
+  p = malloc(BULK);
+  unlink("bulkwrite");
+  fd = open("bulkwrite", O_CREATE | O_RDWR);
+  for(i = 0; i < 3; i++){
+    memset(p, 'a' + i, BULK);
+    if(write(fd, p, BULK) != BULK){
+      printf(1, "bulkwrite: write %d failed\n", i);
+      exit();
+    }
+    if(i == 0){
+      close(fd);
+      unlink("bulkwrite");
+      fd = open("bulkwrite", O_CREATE | O_RDWR);
+    }
+  }
+  memset(p, 'z', BULK);
+  if(pwrite(fd, p, BULK, 100) != BULK){
+    printf(1, "bulkwrite: overwrite failed\n");
+    exit();
+  }
+  close(fd);
+
+  fd = open("bulkwrite", O_RDONLY);
+  for(i = 0; i < 2; i++){
+    if(read(fd, p, BULK) != BULK){
+      printf(1, "bulkwrite: read failed\n");
+      exit();
+    }
+    for(j = 0; j < BULK; j++){
+      off = i*BULK + j;
+      if(p[j] != (off < 100 ? 'b' : off < 100 + BULK ? 'z' : 'c')){
+        printf(1, "bulkwrite: wrong byte at %d\n", off);
+        exit();
+      }
+    }
+  }
+  if(read(fd, p, 1) != 0){
+    printf(1, "bulkwrite: file too long\n");
+    exit();
+  }
+  close(fd);
+  free(p);
+  unlink("bulkwrite");
+  printf(1, "bulkwrite ok\n");
+}
+
 void
 bigfile(void)
 {
@@ -1280,6 +1863,57 @@ rmdot(void)
   printf(1, "rmdot ok\n");
 }
 
+// Lookups that fail, then succeed, then fail again must not be
+// answered from stale directory entry cache entries, even when
+// a removed directory's inode is reused for a new one.
+void
+dcachetest(void)
+{
+  int i, fd;
+
+  printf(1, "dcache test\n");
+  for(i = 0; i < 2; i++){
+    if(open("dcd/f", 0) >= 0){
+      printf(1, "open dcd/f before mkdir succeeded!\n");
+      exit();
+    }
+    if(mkdir("dcd") != 0){
+      printf(1, "mkdir dcd failed\n");
+      exit();
+    }
+    if(open("dcd/f", 0) >= 0){
+      printf(1, "open dcd/f before create succeeded!\n");
+      exit();
+    }
+    if(i == 0){
+      fd = open("dcd/f", O_CREATE|O_RDWR);
+      if(fd < 0){
+        printf(1, "create dcd/f failed\n");
+        exit();
+      }
+      close(fd);
+      if((fd = open("dcd/f", 0)) < 0){
+        printf(1, "open dcd/f after create failed\n");
+        exit();
+      }
+      close(fd);
+      if(unlink("dcd/f") != 0){
+        printf(1, "unlink dcd/f failed\n");
+        exit();
+      }
+      if(open("dcd/f", 0) >= 0){
+        printf(1, "open dcd/f after unlink succeeded!\n");
+        exit();
+      }
+    }
+    if(unlink("dcd") != 0){
+      printf(1, "unlink dcd failed\n");
+      exit();
+    }
+  }
+  printf(1, "dcache ok\n");
+}
+
 void
 dirfile(void)
 {
@@ -1765,6 +2399,7 @@ main(int argc, char *argv[])
 
   bigargtest();
   bigwrite();
+  bulkwrite();
   bigargtest();
   bsstest();
   sbrktest();
@@ -1774,6 +2409,8 @@ main(int argc, char *argv[])
   writetest();
   writetest1();
   createtest();
+  inlinetest();
+  fallocatetest();
 
   openiputtest();
   exitiputtest();
@@ -1781,10 +2418,19 @@ main(int argc, char *argv[])
 
   mem();
   pipe1();
+  pipesizetest();
+  splicetest();
+  polltest();
+  ringtest();
+  preadtest();
+  fsynctest();
+  tmpfstest();
+  vdsotest();
   preempt();
   exitwait();
 
   rmdot();
+  dcachetest();
   fourteen();
   bigfile();
   subdir();
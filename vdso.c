@@ -0,0 +1,65 @@
+// The page described in vdso.h.  vm.c maps it into every
+// user page table; the clock interrupt and the scheduler
+// keep it current.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "x86.h"
+#include "vdso.h"
+
+#define CALIBRATE 16  // ticks over which to count TSC cycles
+
+struct vdso *vdso;
+
+static uint calibtsc;  // TSC when the current calibration began
+
+void
+vdsoinit(void)
+{
+  if(sizeof(struct vdso) + NPROC*sizeof(struct vdsoproc) > PGSIZE)
+    panic("vdsoinit: too many procs");
+  if((vdso = (struct vdso*)kalloc()) == 0)
+    panic("vdsoinit: out of memory");
+  if((uint)&vdso->sysenter - (uint)vdso != VDSO_SYSENTER - VDSO)
+    panic("vdsoinit: VDSO_SYSENTER");
+  memset(vdso, 0, PGSIZE);
+  vdso->ncpu = ncpu;
+  // The other CPUs have run sysenterinit(); this one
+  // runs it later, in mpmain().
+  vdso->sysenter = !nosysenter && (cpuidedx(1) & CPUID_SEP);
+}
+
+// Record a clock tick.  Called by one CPU, holding tickslock.
+void
+vdsotick(void)
+{
+  uint tsc;
+
+  tsc = rdtsc();
+  vdso->seq++;
+  __sync_synchronize();
+  vdso->ticks = ticks;
+  vdso->ticktsc = tsc;
+  if(ticks % CALIBRATE == 0){
+    if(calibtsc)
+      vdso->tscpertick = (tsc - calibtsc) / CALIBRATE;
+    calibtsc = tsc;
+  }
+  __sync_synchronize();
+  vdso->seq++;
+}
+
+// Fill in slot for p, about to run on this CPU, and
+// point this CPU's SEG_UVDSO segment at it.
+void
+vdsoswitch(struct proc *p, int slot)
+{
+  vdso->proc[slot].pid = p->pid;
+  vdso->proc[slot].tid = p->tid;
+  mycpu()->gdt[SEG_UVDSO] = SEG16(0, VDSO + (uint)&vdso->proc[slot] - (uint)vdso,
+                                  sizeof(struct vdsoproc)-1, DPL_USER);
+}
@@ -0,0 +1,29 @@
+// A page the kernel keeps up to date and maps read-only
+// into every process at VDSO, so that programs can read the
+// time and who they are without a system call.
+//
+// Each process has a slot in proc[]; the kernel points a
+// segment at the running one's, so %gs:0 is its pid and
+// %gs:4 its tid, even for threads sharing a page table.
+
+#define VDSO 0x7FFFF000  // KERNBASE - PGSIZE
+
+// Address of struct vdso's sysenter, for usys.S.
+#define VDSO_SYSENTER (VDSO + 20)
+
+#ifndef __ASSEMBLER__
+struct vdsoproc {
+  int pid;
+  int tid;
+};
+
+struct vdso {
+  uint seq;          // odd while the kernel updates the fields below
+  uint ticks;        // as returned by uptime()
+  uint ticktsc;      // low 32 bits of the TSC at that tick
+  uint tscpertick;   // TSC cycles per tick, 0 until measured
+  int ncpu;
+  int sysenter;      // every CPU has sysenter; else use int $T_SYSCALL
+  struct vdsoproc proc[];  // NPROC slots
+};
+#endif
@@ -0,0 +1,286 @@
+// Disk driver for a legacy virtio-blk PCI device.
+// A drop-in replacement for ide.c: provides ideinit(),
+// ideintr() and iderw(), so bio.c does not care which
+// is linked in.  Selected with make DISK=virtio.
+//
+// Unlike the IDE disk, the device accepts many requests
+// at once: iderw() hands the I/O scheduler's requests to
+// the virtqueue while descriptors last, and ideintr()
+// completes every finished request in one go.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "x86.h"
+#include "traps.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "buf.h"
+#include "pci.h"
+#include "virtio.h"
+
+#define SECTOR_SIZE 512
+
+// Per-request state, indexed by the head descriptor.
+// The device reads hdr and writes status, so both must
+// live in directly mapped kernel memory.
+struct vreq {
+  struct buf *b;
+  struct virtio_blk_req hdr;
+  uchar status;
+};
+
+static struct spinlock vlock;
+static ushort iobase;
+static int qsize;
+static int eventidx;        // VIRTIO_RING_F_EVENT_IDX negotiated
+static uint capacity;       // disk size in blocks
+
+static struct vring_desc *desc;
+static struct vring_avail *avail;
+static struct vring_used *used;
+static ushort *usedevent;   // in avail ring: interrupt after this used idx
+static ushort *availevent;  // in used ring: notify after this avail idx
+
+static ushort freedesc;     // head of free descriptor list, through next
+static int nfree;
+static int inflight;
+static ushort lastused;     // used->idx already processed
+static struct vreq reqs[VRING_MAXSIZE];
+
+static char vring[VRING_SIZE(VRING_MAXSIZE)] __attribute__((aligned(VRING_ALIGN)));
+
+// Take a descriptor off the free list.
+// Each request uses three: header, data and status.
+static int
+allocdesc(void)
+{
+  int i;
+
+  if(nfree == 0)
+    panic("virtio: no descriptors");
+  i = freedesc;
+  freedesc = desc[i].next;
+  nfree--;
+  return i;
+}
+
+// Free the descriptor chain starting at i.
+static void
+freechain(int i)
+{
+  int next, more;
+
+  do {
+    more = desc[i].flags & VRING_DESC_F_NEXT;
+    next = desc[i].next;
+    desc[i].next = freedesc;
+    desc[i].flags = 0;
+    freedesc = i;
+    nfree++;
+    i = next;
+  } while(more);
+}
+
+void
+ideinit(void)
+{
+  struct pcidev d;
+  uint feat;
+  int i;
+
+  initlock(&vlock, "virtio");
+  ioschedinit();
+
+  if(pcifind(VIRTIO_VENDOR, VIRTIO_DEV_BLK, -1, 0, &d) < 0)
+    panic("virtio: no block device");
+  if((d.bar[0] & PCI_BAR_IO) == 0)
+    panic("virtio: bar0 not i/o");
+  pcienable(&d);
+  iobase = d.bar[0] & ~3;
+
+  // Reset, then announce ourselves.
+  outb(iobase + VIRTIO_STATUS, 0);
+  outb(iobase + VIRTIO_STATUS, VIRTIO_S_ACK);
+  outb(iobase + VIRTIO_STATUS, VIRTIO_S_ACK | VIRTIO_S_DRIVER);
+
+  feat = inl(iobase + VIRTIO_HOSTFEAT);
+  if(feat & (1 << VIRTIO_BLK_F_RO))
+    panic("virtio: disk is read-only");
+  eventidx = (feat & (1 << VIRTIO_RING_F_EVENT_IDX)) != 0;
+  outl(iobase + VIRTIO_GUESTFEAT, eventidx ? 1 << VIRTIO_RING_F_EVENT_IDX : 0);
+
+  // Set up queue 0.
+  outw(iobase + VIRTIO_QSEL, 0);
+  qsize = inw(iobase + VIRTIO_QSIZE);
+  if(qsize == 0 || qsize > VRING_MAXSIZE)
+    panic("virtio: bad queue size");
+  memset(vring, 0, sizeof(vring));
+  desc = (struct vring_desc*)vring;
+  avail = (struct vring_avail*)(vring + 16*qsize);
+  used = (struct vring_used*)(vring + ((16*qsize + 2*(3+qsize) + VRING_ALIGN-1) & ~(VRING_ALIGN-1)));
+  usedevent = &avail->ring[qsize];
+  availevent = (ushort*)&used->ring[qsize];
+  for(i = 0; i < qsize; i++)
+    desc[i].next = i + 1;
+  freedesc = 0;
+  nfree = qsize;
+  outl(iobase + VIRTIO_QADDR, V2P(vring) / VRING_ALIGN);
+
+  outb(iobase + VIRTIO_STATUS, VIRTIO_S_ACK | VIRTIO_S_DRIVER | VIRTIO_S_DRIVER_OK);
+
+  capacity = inl(iobase + VIRTIO_BLK_CAPACITY) / (BSIZE/SECTOR_SIZE);
+  if(inl(iobase + VIRTIO_BLK_CAPACITY + 4) != 0)
+    capacity = 0xffffffff;
+
+  // virtio-blk stands in for the IDE disk, so
+  // take its interrupts on the IDE vector.
+  ioapicroutepci(d.irq, T_IRQ0 + IRQ_IDE, ncpu - 1);
+  cprintf("virtio: blk at 0x%x irq %d, queue %d, %d blocks\n",
+          iobase, d.irq, qsize, capacity);
+}
+
+// Move requests from the scheduler onto the avail ring
+// while there are descriptors for them, then tell the
+// device about them.  Caller must hold vlock.
+static void
+virtiostart(void)
+{
+  struct buf *b;
+  struct vreq *r;
+  ushort old;
+  int h, i, j;
+
+  old = avail->idx;
+  while(nfree >= 3 && (b = ioschednext()) != 0){
+    h = allocdesc();
+    i = allocdesc();
+    j = allocdesc();
+    r = &reqs[h];
+    r->b = b;
+    r->status = 0xff;
+    r->hdr.type = (b->flags & B_DIRTY) ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+    r->hdr.reserved = 0;
+    r->hdr.sector = b->blockno * (BSIZE/SECTOR_SIZE);
+    r->hdr.sectorhi = 0;
+
+    desc[h].addr = V2P(&r->hdr);
+    desc[h].addrhi = 0;
+    desc[h].len = sizeof(r->hdr);
+    desc[h].flags = VRING_DESC_F_NEXT;
+    desc[h].next = i;
+
+    desc[i].addr = V2P(b->data);
+    desc[i].addrhi = 0;
+    desc[i].len = BSIZE;
+    desc[i].flags = VRING_DESC_F_NEXT;
+    if(!(b->flags & B_DIRTY))
+      desc[i].flags |= VRING_DESC_F_WRITE;
+    desc[i].next = j;
+
+    desc[j].addr = V2P(&r->status);
+    desc[j].addrhi = 0;
+    desc[j].len = 1;
+    desc[j].flags = VRING_DESC_F_WRITE;
+    desc[j].next = 0;
+
+    avail->ring[avail->idx % qsize] = h;
+    __sync_synchronize();
+    avail->idx++;
+    inflight++;
+  }
+  if(avail->idx == old)
+    return;
+
+  // Make the new idx visible before looking at whether
+  // the device wants to be notified.
+  __sync_synchronize();
+  if(eventidx){
+    if((ushort)(avail->idx - *availevent - 1) < (ushort)(avail->idx - old))
+      outw(iobase + VIRTIO_QNOTIFY, 0);
+  } else if(!(used->flags & VRING_USED_F_NO_NOTIFY))
+    outw(iobase + VIRTIO_QNOTIFY, 0);
+}
+
+// Interrupt handler: finish every completed request.
+void
+ideintr(void)
+{
+  struct vring_used_elem *e;
+  struct vreq *r;
+  struct buf *b;
+
+  acquire(&vlock);
+  inb(iobase + VIRTIO_ISR);  // acknowledge; deasserts the interrupt
+
+again:
+  while(lastused != used->idx){
+    __sync_synchronize();
+    e = &used->ring[lastused % qsize];
+    r = &reqs[e->id];
+    b = r->b;
+    r->b = 0;
+    freechain(e->id);
+    inflight--;
+    lastused++;
+
+    ioscheddone(b);
+    if(r->status != VIRTIO_BLK_S_OK){
+      cprintf("virtio: i/o error on block %d\n", b->blockno);
+      b->flags |= B_ERROR;
+    } else
+      b->flags |= B_VALID;
+    b->flags &= ~B_DIRTY;
+    wakeup(b);
+  }
+
+  // Coalesce: with several requests still in flight, ask
+  // for the next interrupt only once about half of them
+  // have finished, rather than one interrupt each.
+  if(eventidx){
+    *usedevent = lastused + (inflight > 1 ? (inflight-1)/2 : 0);
+    // The device may have finished a request after the loop
+    // last looked, and compared it with the old used_event,
+    // so owes no interrupt for it.  Look again.
+    __sync_synchronize();
+    if(lastused != used->idx)
+      goto again;
+  }
+
+  virtiostart();
+  release(&vlock);
+}
+
+//PAGEBREAK!
+// Sync buf with disk.
+// If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
+// Else if B_VALID is not set, read buf from disk, set B_VALID.
+// Return -1 if the disk failed the request.
+int
+iderw(struct buf *b)
+{
+  if(!holdingsleep(&b->lock))
+    panic("iderw: buf not locked");
+  if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
+    panic("iderw: nothing to do");
+  if(b->dev != ROOTDEV)
+    panic("iderw: request not for disk 1");
+  if(b->blockno >= capacity)
+    panic("iderw: block out of range");
+
+  acquire(&vlock);
+  ioschedadd(b);
+  virtiostart();
+  while((b->flags & (B_VALID|B_DIRTY)) != B_VALID && !(b->flags & B_ERROR))
+    sleep(b, &vlock);
+  release(&vlock);
+  if(b->flags & B_ERROR){
+    b->flags &= ~B_ERROR;
+    return -1;
+  }
+  return 0;
+}
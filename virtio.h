@@ -0,0 +1,82 @@
+// Legacy virtio over PCI, as emulated by QEMU's
+// virtio-blk-pci with disable-modern=on.
+// http://docs.oasis-open.org/virtio/virtio/v1.0/virtio-v1.0.html
+// (sections 2.4 and 4.1.4.8, "Legacy Interfaces").
+
+#define VIRTIO_VENDOR     0x1AF4
+#define VIRTIO_DEV_BLK    0x1001  // transitional block device
+
+// Registers in the I/O space of BAR0.
+#define VIRTIO_HOSTFEAT   0x00  // device features (32 bits)
+#define VIRTIO_GUESTFEAT  0x04  // driver features (32 bits)
+#define VIRTIO_QADDR      0x08  // queue address / 4096 (32 bits)
+#define VIRTIO_QSIZE      0x0C  // queue size (16 bits)
+#define VIRTIO_QSEL       0x0E  // queue select (16 bits)
+#define VIRTIO_QNOTIFY    0x10  // queue notify (16 bits)
+#define VIRTIO_STATUS     0x12  // device status (8 bits)
+#define VIRTIO_ISR        0x13  // interrupt status; read clears (8 bits)
+#define VIRTIO_CONFIG     0x14  // device config, without MSI-X
+
+// Device status bits.
+#define VIRTIO_S_ACK       1
+#define VIRTIO_S_DRIVER    2
+#define VIRTIO_S_DRIVER_OK 4
+#define VIRTIO_S_FAILED    128
+
+// Feature bits.
+#define VIRTIO_BLK_F_RO        5   // disk is read-only
+#define VIRTIO_RING_F_EVENT_IDX 29 // used_event/avail_event fields
+
+// Block device config: capacity in 512-byte sectors (64 bits).
+#define VIRTIO_BLK_CAPACITY  (VIRTIO_CONFIG + 0)
+
+// Virtqueue layout.
+#define VRING_ALIGN 4096
+#define VRING_MAXSIZE 256  // largest queue the driver accepts
+
+struct vring_desc {
+  uint addr;       // physical address
+  uint addrhi;
+  uint len;
+  ushort flags;
+  ushort next;
+};
+#define VRING_DESC_F_NEXT   1  // chained with next
+#define VRING_DESC_F_WRITE  2  // device writes (vs reads)
+
+struct vring_avail {
+  ushort flags;
+  ushort idx;
+  ushort ring[];   // then ushort used_event
+};
+#define VRING_AVAIL_F_NO_INTERRUPT 1
+
+struct vring_used_elem {
+  uint id;         // head of the completed descriptor chain
+  uint len;
+};
+
+struct vring_used {
+  ushort flags;
+  ushort idx;
+  struct vring_used_elem ring[];  // then ushort avail_event
+};
+#define VRING_USED_F_NO_NOTIFY 1
+
+// Bytes of memory needed by a queue of size n.
+#define VRING_SIZE(n) \
+  (((16*(n) + 2*(3+(n)) + VRING_ALIGN-1) & ~(VRING_ALIGN-1)) + \
+   ((2*3 + 8*(n) + VRING_ALIGN-1) & ~(VRING_ALIGN-1)))
+
+// Block request header; the device reads it, then the data,
+// then writes one status byte.
+struct virtio_blk_req {
+  uint type;
+  uint reserved;
+  uint sector;
+  uint sectorhi;
+};
+#define VIRTIO_BLK_T_IN   0  // read
+#define VIRTIO_BLK_T_OUT  1  // write
+
+#define VIRTIO_BLK_S_OK   0